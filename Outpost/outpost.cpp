@@ -9,20 +9,62 @@
     Thanks to Kevin Brown (plight on BGG) for early feedback and advice.
 */
 
+// The hosted games (--env, --host and --serve) each run on a fiber, which needs <ucontext.h>.  macOS only
+// declares it (deprecated) under _XOPEN_SOURCE, and then hides its own extensions unless asked for them too.
+#if defined(__APPLE__) && !defined(_XOPEN_SOURCE)
+#define _XOPEN_SOURCE 600
+#define _DARWIN_C_SOURCE
+#endif
+
+// Set to 0 to leave out everything that runs games on fibers: --env, --host, --serve and --bots.
+#ifndef OUTPOST_FIBERS
+#ifdef _WIN32
+#define OUTPOST_FIBERS 0
+#else
+#define OUTPOST_FIBERS 1
+#endif
+#endif
+
 #include <assert.h>
 #include <ctype.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
 #ifndef _WIN32
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
 #include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <unistd.h>
 #endif
+#if OUTPOST_FIBERS
+#include <ucontext.h>
+#endif
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
 
 #include <string>
 #include <iostream>
 #include <vector>
+#include <deque>
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <type_traits>
 
 using namespace std;
 
@@ -31,45 +73,134 @@ using namespace std;
 
 int debugLevel = 0;
 
+// Set to 0 to compile all narration out of the game entirely.
+#ifndef OUTPOST_NARRATION
+#define OUTPOST_NARRATION 1
+#endif
+
+// Where narration ends up.  mystream_t does the word wrapping; a sink only stores or displays the result.
+class outputSink_t {
+public:
+    virtual ~outputSink_t() { }
+    virtual void write(const char *s,size_t len) = 0;
+    virtual void flush() { }
+    // width to wrap lines at.
+    virtual int getWidth() { return 80; }
+    // called whenever the user has typed something.
+    virtual void hadInput() { }
+};
+
+// The terminal.  Output is buffered by stdio and flushed before we wait for input.
+// Its width is measured once up front (not every time a thread's stream is made), and again after input.
+class consoleSink_t: public outputSink_t {
+    int width;
+    
+    void measure() {
+        width = 80;
+#ifndef _WIN32
+        struct winsize w;
+        if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &w) >= 0 && w.ws_col)
+            width = w.ws_col;
+#endif
+    }
+public:
+    consoleSink_t() { measure(); }
+    void write(const char *s,size_t len) { fwrite(s, 1, len, stdout); }
+    void flush() { fflush(stdout); }
+    int getWidth() { return width; }
+    // the terminal may have been resized while we waited.
+    void hadInput() { measure(); }
+};
+
+// A log file, written in large blocks.
+class fileSink_t: public outputSink_t {
+    FILE *file;
+    vector<char> buffer;
+public:
+    // takes ownership of the file.
+    fileSink_t(FILE *f) : file(f), buffer(1 << 16) { setvbuf(file, &buffer[0], _IOFBF, buffer.size()); }
+    ~fileSink_t() { fclose(file); }
+    void write(const char *s,size_t len) { fwrite(s, 1, len, file); }
+    void flush() { fflush(file); }
+};
+
+// Collects output in memory, eg so that one game's narration can be written to a shared log all at once.
+class stringSink_t: public outputSink_t {
+public:
+    string text;
+    void write(const char *s,size_t len) { text.append(s, len); }
+};
+
+consoleSink_t console;
+
 class mystream_t {
     string buffer;
     int column, leftMargin, rightMargin;
+    outputSink_t *sink;
+    
+    // formats into the end of a buffer that's at least 21 bytes, returning where the digits start.
+    static char *formatUnsigned(char *end,unsigned long lu) {
+        *--end = 0;
+        do {
+            *--end = char('0' + lu % 10);
+            lu /= 10;
+        } while (lu);
+        return end;
+    }
 public:
-    mystream_t() : column(0), leftMargin(0), rightMargin(80) { 
+    mystream_t() : column(0), leftMargin(0), rightMargin(80), sink(&console) { 
+        rightMargin = sink->getWidth();
+    }
+    
+    void hadInput() { 
+        column = 0; 
+        if (sink) {
+            sink->hadInput();
+            rightMargin = sink->getWidth();
+        }
+    }
+
+    // A null sink turns narration off; nothing is formatted or written at all then.
+    void setSink(outputSink_t *s) { 
+        sink = s;
+        column = 0;
+        if (sink)
+            rightMargin = sink->getWidth();
     }
+    outputSink_t *getSink() const { return sink; }
+    bool isEnabled() const { return OUTPOST_NARRATION && sink; }
     
-    void hadInput() { column = 0; }
+    // call before waiting on the user so the prompt is visible.
+    void flush() {
+        if (sink)
+            sink->flush();
+    }
 
-    void output(const char *s) { 
-        cout << s;
+    void output(const char *s,size_t len) { 
+        sink->write(s,len);
     }
     
     void wordbreak() {
-        output("\n");
+        output("\n",1);
         column = 0;
         while (column < leftMargin) {
-            output(" ");
+            output(" ",1);
             ++column;
         }
-#ifndef _WIN32
-        // recheck terminal width after every line in case it's resized at runtime.
-        // could just do this on terminal input instead.
-        struct winsize w;
-        if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &w) >= 0 && w.ws_col)
-            rightMargin = w.ws_col;
-#endif
     }
     
     void setLeftMargin(int lm) { leftMargin = lm; }
     
     mystream_t &operator<<(const char*s) { 
+        if (!isEnabled())
+            return *this;
         while (*s) {
             char c = *s++;
             if (c == ' ' || c == '\n') {
                 if (buffer.size()) {
                     if (column + buffer.size() >= rightMargin)
                         wordbreak();
-                    output(buffer.c_str());
+                    output(buffer.data(),buffer.size());
                     column += buffer.size();
                     buffer.clear();
                 }
@@ -77,10 +208,10 @@ public:
                     if (++column==rightMargin)
                         wordbreak();
                     else
-                        output(" ");
+                        output(" ",1);
                 }
                 else {
-                    output("\n");
+                    output("\n",1);
                     column = 0;
                 }
             }
@@ -90,19 +221,23 @@ public:
         return *this;
     }
     mystream_t &operator<<(unsigned long lu) {
+        if (!isEnabled())
+            return *this;
         char buf[32];
-        sprintf(buf,"%lu",lu);
-        return operator<<(buf);
+        return operator<<(formatUnsigned(buf + sizeof(buf),lu));
     }
     mystream_t &operator<<(unsigned u) {
-        char buf[32];
-        sprintf(buf,"%u",u);
-        return operator<<(buf);
+        return operator<<((unsigned long)u);
     }
     mystream_t &operator<<(int i) {
+        if (!isEnabled())
+            return *this;
+        if (i >= 0)
+            return operator<<((unsigned long)i);
         char buf[32];
-        sprintf(buf,"%d",i);
-        return operator<<(buf);
+        char *digits = formatUnsigned(buf + sizeof(buf),0UL - (unsigned long)i);
+        *--digits = '-';
+        return operator<<(digits);
     }
     mystream_t &operator<<(const string& s) { return operator<<(s.c_str()); }
 };
@@ -124,7 +259,41 @@ private:
     _Type array[count];
 };
 
-mystream_t table;
+// Narration is per-thread so that batch games running on worker threads never share a stream.
+thread_local mystream_t table;
+
+// Small, fast generator (PCG32) owned by each game.  Everything random in a game draws from it,
+// so a game replays exactly from its seed on any platform and games on different threads never
+// share hidden state.
+class rng_t {
+    uint64_t state;
+public:
+    explicit rng_t(uint64_t s = 0) { seed(s); }
+    
+    void seed(uint64_t s) {
+        state = 0;
+        next();
+        state += s;
+        next();
+    }
+    
+    uint32_t next() {
+        uint64_t old = state;
+        state = old * 6364136223846793005ULL + 1442695040888963407ULL;
+        uint32_t xorshifted = uint32_t(((old >> 18) ^ old) >> 27);
+        uint32_t rot = uint32_t(old >> 59);
+        return (xorshifted >> rot) | (xorshifted << ((0u - rot) & 31));
+    }
+    
+    // uniform value in [0,n) by multiply-and-shift instead of a division; the bias is at most n/2^32.
+    uint32_t below(uint32_t n) { return uint32_t((uint64_t(next()) * n) >> 32); }
+    
+    // Fisher-Yates; random_shuffle is gone as of C++17 and its generator was implementation-defined anyway.
+    template <class _It> void shuffle(_It first,_It last) {
+        for (uint32_t i=uint32_t(last - first); i>1; i--)
+            swap(first[i-1], first[below(i)]);
+    }
+};
 
 enum turnphase_t {
     AUCTION_BEFORE_MY_TURN,
@@ -164,7 +333,8 @@ const char *factoryHelp[PRODUCTION_COUNT] = {
 
 static const byte_t factoryCosts[] = { 10,20,30,30,0,60,0,0,0 };
 
-static const byte_t vpsForMannedFactory[PRODUCTION_COUNT] = { 1,1,2,2,0,3,10,15,20 };
+// the extra entry is for UNUSED personnel, who don't earn anything.
+static const byte_t vpsForMannedFactory[PRODUCTION_COUNT + 1] = { 1,1,2,2,0,3,10,15,20,0 };
 
 enum upgradeEnum_t { 
     DATA_LIBRARY, 
@@ -190,7 +360,7 @@ static const byte_t vpsForUpgrade[UPGRADE_COUNT] = { 1,1,1,2,2, 3,3,5,5,5, 0,0,0
 
 // This is used by AI to just potential VP swing for an upgrade.  Assumes any included factory will be manned.
 // This is why the entries for LABORATORY, OUTPOST, and the era 3 upgrades are higher than the values in vpsForUpgrade.
-static const byte_t potentialVpsForUpgrade[UPGRADE_COUNT] = { 1,1,1,2,2,3,3,7,5,7,10,15,20 };
+static constexpr byte_t potentialVpsForUpgrade[UPGRADE_COUNT] = { 1,1,1,2,2,3,3,7,5,7,10,15,20 };
 
 const char *upgradeHelp[UPGRADE_COUNT] = {
     "10$ discount/Scientists, 10$ discount/Laboratory",
@@ -256,15 +426,54 @@ const char *basicRules =
     
 
 
-const byte_t upgradeCosts[UPGRADE_COUNT] = { 15,25,30,25,40, 50,50,80,30,100, 120,160,200 };
+static constexpr byte_t upgradeCosts[UPGRADE_COUNT] = { 15,25,30,25,40, 50,50,80,30,100, 120,160,200 };
+
+// Discounts on each upgrade: so much per copy owned of up to two others.
+struct upgradeDiscount_t {
+    byte_t from[2], per[2];
+};
+
+static constexpr upgradeDiscount_t upgradeDiscounts[UPGRADE_COUNT] = {
+    { { DATA_LIBRARY, DATA_LIBRARY }, { 0, 0 } },
+    { { HEAVY_EQUIPMENT, DATA_LIBRARY }, { 5, 0 } },        // Warehouse
+    { { DATA_LIBRARY, DATA_LIBRARY }, { 0, 0 } },
+    { { HEAVY_EQUIPMENT, DATA_LIBRARY }, { 5, 0 } },        // Nodule
+    { { DATA_LIBRARY, DATA_LIBRARY }, { 10, 0 } },          // Scientists
+    { { DATA_LIBRARY, DATA_LIBRARY }, { 0, 0 } },
+    { { DATA_LIBRARY, DATA_LIBRARY }, { 0, 0 } },
+    { { DATA_LIBRARY, DATA_LIBRARY }, { 10, 0 } },          // Laboratory
+    { { DATA_LIBRARY, DATA_LIBRARY }, { 0, 0 } },
+    { { HEAVY_EQUIPMENT, ECOPLANTS }, { 15, 10 } },         // Outpost
+    { { DATA_LIBRARY, DATA_LIBRARY }, { 0, 0 } },
+    { { DATA_LIBRARY, DATA_LIBRARY }, { 0, 0 } },
+    { { DATA_LIBRARY, DATA_LIBRARY }, { 0, 0 } }
+};
 
 #define NELEM(x)    (sizeof(x)/sizeof(x[0]))
 
 static const unsigned EMPTY = 0x7FFFFFFF;
 
-static unsigned readUnsigned() {
+// Where a human's answers come from, a line at a time.
+class inputSource_t {
+public:
+    virtual ~inputSource_t() { }
+    // false once there is nothing more to read; every answer is empty from then on.
+    virtual bool readLine(string &line) = 0;
+};
+
+// The terminal.
+class keyboardSource_t: public inputSource_t {
+public:
+    bool readLine(string &line) { return bool(getline(cin,line)); }
+};
+
+keyboardSource_t keyboard;
+
+static unsigned readUnsigned(inputSource_t &in = keyboard) {
     string answer;
-    getline(cin,answer);
+    table.flush();
+    if (!in.readLine(answer))
+        answer.clear();
     table.hadInput();
     if (answer.size())
         return atoi(answer.c_str());
@@ -272,9 +481,11 @@ static unsigned readUnsigned() {
         return EMPTY;
 }
 
-static char readLetter() {
+static char readLetter(inputSource_t &in = keyboard) {
     string answer;
-    getline(cin,answer);
+    table.flush();
+    if (!in.readLine(answer))
+        answer.clear();
     table.hadInput();
     return toupper(answer[0]);
 }
@@ -291,6 +502,9 @@ struct card_t {
 };
 
 typedef size_t cardIndex_t;
+static const size_t MAX_PLAYERS = 9;
+typedef unsigned long long cardMask_t;      // bit N set selects hand[hand.maskBase() + N]
+static const size_t MAX_CARDS_IN_MASK = 64;
 typedef size_t playerIndex_t;
 typedef unsigned amt_t;
 typedef int money_t;
@@ -299,112 +513,357 @@ struct cardDistribution_t {
     byte_t value, count;
 };
 
+static constexpr cardDistribution_t OreDeck[] = { {1,6}, {2,8}, {3,8}, {4,8}, {5,6} };
+static constexpr cardDistribution_t WaterDeck[] = { {4,3}, {5,5}, {6,7}, {7,9}, {8,7}, {9,5}, {10,3} };
+static constexpr cardDistribution_t TitaniumDeck[] = { {7,5}, {8,7}, {9,9}, {10,11}, {11,9}, {12,7}, {13,5} };
+static constexpr cardDistribution_t ResearchDeck[] = { {9,2}, {10,3}, {11,4}, {12,5}, {13,6}, {14,5}, {15,4}, {16,3}, {17,2} };
+static constexpr cardDistribution_t MicrobioticsDeck[] = { {14,1}, {15,2}, {16,3}, {17,4}, {18,3}, {19,2}, {20,1} };
+static constexpr cardDistribution_t NewChemicalsDeck[] = { {14,2}, {16,3}, {18,4}, {20,5}, {22,4}, {24,3}, {26,2} };
+static constexpr cardDistribution_t OrbitalMedicineDeck[] = { {20,2}, {25,3}, {30,4}, {35,3}, {40,2} };
+static constexpr cardDistribution_t RingOreDeck[] = { {30,1}, {35,3}, {40,4}, {45,3}, {50,1} };
+static constexpr cardDistribution_t MoonOreDeck[] = { {40,1}, {45,3}, {50,4}, {55,3}, {60,1} };
+
+// Everything about each production deck that never changes.
+struct deckSpec_t {
+    const cardDistribution_t *dist;
+    size_t count;
+    byte_t average;         // value of the "proxy" card handed out when the deck and discards are both empty
+    byte_t megaValue;       // zero if the deck has no Mega card
+    byte_t countsInHandSize;
+};
+
+static constexpr deckSpec_t deckSpecs[PRODUCTION_COUNT] = {
+    { OreDeck, NELEM(OreDeck), 3, 0, true },
+    { WaterDeck, NELEM(WaterDeck), 7, 30, true },
+    { TitaniumDeck, NELEM(TitaniumDeck), 10, 44, true },
+    { ResearchDeck, NELEM(ResearchDeck), 13, 0, false },
+    { MicrobioticsDeck, NELEM(MicrobioticsDeck), 17, 0, false },
+    { NewChemicalsDeck, NELEM(NewChemicalsDeck), 20, 88, true },
+    { OrbitalMedicineDeck, NELEM(OrbitalMedicineDeck), 30, 0, true },
+    { RingOreDeck, NELEM(RingOreDeck), 40, 0, true },
+    { MoonOreDeck, NELEM(MoonOreDeck), 50, 0, true }
+};
+
+// What a number of cards from one deck are worth on average, counting a Mega for every four of them
+// when the deck has one (they're always worth a bit more than four ordinary cards).
+static money_t expectedCardValue(productionEnum_t which,amt_t cards) {
+    const deckSpec_t &spec = deckSpecs[which];
+    if (spec.megaValue)
+        return (cards / 4) * spec.megaValue + (cards % 4) * spec.average;
+    else
+        return cards * spec.average;
+}
+
+// Size of the biggest production deck (Titanium), and the most different values in one (Research).
+static const size_t MAX_DECK_CARDS = 53;
+static const size_t MAX_DECK_VALUES = 9;
+
+// How many cards a deck has, and how far apart the least and most any number of them can add up to.
+static constexpr size_t cardsIn(const deckSpec_t &spec,size_t i = 0) {
+    return i < spec.count? spec.dist[i].count + cardsIn(spec,i+1) : 0;
+}
+static constexpr size_t deckSpread(const deckSpec_t &spec) {
+    return cardsIn(spec) * (spec.dist[spec.count-1].value - spec.dist[0].value);
+}
+
+// Where a card of the given value comes in its deck's distribution.
+static size_t valueIndex(const deckSpec_t &spec,byte_t value) {
+    size_t i = 0;
+    while (spec.dist[i].value != value) {
+        i++;
+        assert(i < spec.count);
+    }
+    return i;
+}
+
+// A production deck's draw pile and discards share one fixed array, since between them they never
+// hold more than the deck started with: the draw pile fills it from the bottom up (its top card is the
+// highest), and the discards fill it from the end down.
 class productionDeck_t {
-    vector<byte_t> deck;
-    typedef vector<byte_t>::iterator deckIt_t;
-    vector<byte_t> discards;
-    typedef vector<byte_t>::iterator discardsIt_t;
-    typedef vector<byte_t>::const_iterator const_discardsIt_t;
+    byte_t cards[MAX_DECK_CARDS];
+    byte_t deckSize, discardSize;
+    uint16_t discardSum;
+    byte_t discardCounts[MAX_DECK_VALUES];      // how many of each value in spec have been discarded
+    const deckSpec_t *spec;
     byte_t prodType;
     byte_t average;
     byte_t megaSize;
     byte_t countsInHandSize;
+    
+    // the nth card discarded since the last reshuffle
+    byte_t &discard(size_t n) { return cards[MAX_DECK_CARDS - 1 - n]; }
+    byte_t discard(size_t n) const { return cards[MAX_DECK_CARDS - 1 - n]; }
 public:
-    void init(productionEnum_t n,const cardDistribution_t *dist,size_t count,byte_t avg,byte_t mega,byte_t isBig) {
-        deck.clear();
-        for (size_t i=0; i<count; i++) {
-            for (int j=0; j<dist[i].count; j++)
-                deck.push_back(dist[i].value);
+    void init(productionEnum_t n,const deckSpec_t &spec,rng_t &rng) {
+        deckSize = discardSize = 0;
+        discardSum = 0;
+        fill(discardCounts, discardCounts + MAX_DECK_VALUES, 0);
+        this->spec = &spec;
+        for (size_t i=0; i<spec.count; i++) {
+            for (int j=0; j<spec.dist[i].count; j++) {
+                assert(deckSize < MAX_DECK_CARDS);
+                cards[deckSize++] = spec.dist[i].value;
+            }
         }
-        shuffleDeck();
+        shuffleDeck(rng);
         prodType = n;
-        average = avg;
-        megaSize = mega;
-        countsInHandSize = isBig;
+        average = spec.average;
+        megaSize = spec.megaValue;
+        countsInHandSize = spec.countsInHandSize;
     }
 
-    void shuffleDeck() {
-        random_shuffle(deck.begin(), deck.end());
+    void shuffleDeck(rng_t &rng) {
+        rng.shuffle(cards, cards + deckSize);
     }
 
     byte_t getMegaValue() const {
         return megaSize;
     }
 
-    card_t drawCard() {
-        if (deck.size() == 0 && discards.size() != 0) {
-            // discards go to the draw pile, and discard deck is now empty
-            deck.swap(discards);
-            shuffleDeck();
+    card_t drawCard(rng_t &rng) {
+        if (deckSize == 0 && discardSize != 0) {
+            // discards go to the draw pile in the order they were discarded, and discard deck is now empty
+            byte_t *discards = cards + MAX_DECK_CARDS - discardSize;
+            reverse(discards, cards + MAX_DECK_CARDS);
+            copy(discards, discards + discardSize, cards);
+            deckSize = discardSize;
+            discardSize = 0;
+            discardSum = 0;
+            fill(discardCounts, discardCounts + MAX_DECK_VALUES, 0);
+            shuffleDeck(rng);
         }
 
         card_t newCard;
         newCard.prodType = prodType;
         newCard.handSize = countsInHandSize;
         // if the discard pile was empty too, synthesize a fake card having the average value.
-        if (deck.size() == 0) {
+        if (deckSize == 0) {
             newCard.value = average;
             newCard.returnToDiscard = false;
         }
         else {
             // otherwise take the top of the draw deck and consume it, return it to caller
-            newCard.value = deck.back();
+            newCard.value = cards[--deckSize];
             newCard.returnToDiscard = true;
-            deck.pop_back();
         }
         return newCard;
     }
     
     void discardCard(byte_t value) {
-        discards.push_back(value);
+        assert(deckSize + discardSize < MAX_DECK_CARDS);
+        discard(discardSize++) = value;
+        discardSum += value;
+        discardCounts[valueIndex(*spec,value)]++;
+    }
+    
+    size_t getDiscardSize() const { return discardSize; }
+    
+    // Snapshot support: the draw pile (bottom first) followed by the discards, returns number of cards written.
+    size_t save(byte_t *out,byte_t &deckSizeOut,byte_t &discardSizeOut) const {
+        deckSizeOut = deckSize;
+        discardSizeOut = discardSize;
+        copy(cards, cards + deckSize, out);
+        for (size_t i=0; i<discardSize; i++)
+            out[deckSize + i] = discard(i);
+        return deckSize + discardSize;
+    }
+    
+    size_t restore(const byte_t *in,byte_t deckSizeIn,byte_t discardSizeIn) {
+        deckSize = deckSizeIn;
+        discardSize = discardSizeIn;
+        copy(in, in + deckSize, cards);
+        discardSum = 0;
+        fill(discardCounts, discardCounts + MAX_DECK_VALUES, 0);
+        for (size_t i=0; i<discardSize; i++) {
+            discard(i) = in[deckSize + i];
+            discardSum += discard(i);
+            discardCounts[valueIndex(*spec,discard(i))]++;
+        }
+        return deckSize + discardSize;
     }
     
-    size_t getDiscardSize() const { return discards.size(); }
+    amt_t getDiscardSum() const { return discardSum; }
+    
+    const deckSpec_t &getSpec() const { return *spec; }
+    productionEnum_t getType() const { return productionEnum_t(prodType); }
     
-    amt_t getDiscardSum() const {
-        amt_t sum = 0;
-        for (const_discardsIt_t i=discards.begin(); i!=discards.end(); i++)
-            sum += *i;
-        return sum;
+    // How many cards of each value in the spec haven't been discarded (they're in the draw pile or somebody's hand).
+    void getUndiscarded(byte_t *counts) const {
+        for (size_t i=0; i<spec->count; i++)
+            counts[i] = spec->dist[i].count - discardCounts[i];
     }
 
     void dump() {
-        cout << factoryNames[prodType] << " deck: ";
-        for (deckIt_t i=deck.begin(); i!=deck.end(); i++) {
-            cout << int(*i) << " ";
+        debug << factoryNames[prodType] << " deck: ";
+        for (size_t i=0; i<deckSize; i++) {
+            debug << int(cards[i]) << " ";
         }
-        cout << "<- top\n";
+        debug << "<- top\n";
     }
 };
 
 typedef fixedvector<productionDeck_t,PRODUCTION_COUNT> bank_t;
 // typedef vector<productionDeck_t> bank_t;
 
+// A game's random numbers come from a separate stream for each thing that needs them, all seeded from the
+// game's seed.  So each deck deals the same cards in the same order however many came off the other decks or
+// however often the market was rolled, and the same seed deals the same game whoever sits where (see --duplicate).
+struct gameRngs_t {
+    rng_t decks[PRODUCTION_COUNT];      // shuffles and reshuffles
+    rng_t market;                       // upgrade market rolls, and the upgrade decks for two players
+    rng_t noise;                        // turn order tie-breaks, drawn in seat order
+    
+    void seed(uint64_t s) {
+        rng_t master(s);
+        for (int i=ORE; i<PRODUCTION_COUNT; i++)
+            decks[i].seed((uint64_t(master.next()) << 32) | master.next());
+        market.seed((uint64_t(master.next()) << 32) | master.next());
+        noise.seed((uint64_t(master.next()) << 32) | master.next());
+    }
+};
+
+// Every distinct card there can be: each value in each deck, plus each deck's proxy and Mega cards.
+static const size_t HAND_SLOTS = 69;
+static const size_t MAX_CARD_VALUE = 88;
+static const byte_t NO_SLOT = 0xFF;
+
+// The possible cards in the order hands are sorted in, by value and then type, and which one each card is.
+struct handSlots_t {
+    card_t cards[HAND_SLOTS];
+    byte_t lookup[PRODUCTION_COUNT][MAX_CARD_VALUE+1][2];   // by type, value and returnToDiscard
+    
+    handSlots_t() {
+        size_t n = 0;
+        for (int t=ORE; t<PRODUCTION_COUNT; t++) {
+            const deckSpec_t &spec = deckSpecs[t];
+            for (size_t i=0; i<spec.count; i++) {
+                card_t c = { spec.dist[i].value, byte_t(t), spec.countsInHandSize, true };
+                cards[n++] = c;
+            }
+            card_t proxy = { spec.average, byte_t(t), spec.countsInHandSize, false };
+            cards[n++] = proxy;
+            if (spec.megaValue) {
+                card_t mega = { spec.megaValue, byte_t(t), 4, false };
+                cards[n++] = mega;
+            }
+        }
+        assert(n == HAND_SLOTS);
+        // real cards sort ahead of a proxy of the same value and type.
+        stable_sort(cards, cards + HAND_SLOTS);
+        memset(lookup, NO_SLOT, sizeof(lookup));
+        for (size_t i=0; i<HAND_SLOTS; i++)
+            lookup[cards[i].prodType][cards[i].value][cards[i].returnToDiscard] = byte_t(i);
+    }
+};
+
+static const handSlots_t handSlots;
+
+// A hand of production cards, kept as how many of each possible card it holds, so cards come and go
+// in constant time and it's always in sorted order.  Cards are numbered in that order; numbers are
+// only good until the hand changes.  (The value of the hand and the room it takes up are kept
+// in playerState_t.)
+struct hand_t {
+    // Research and Microbiotics have no hand limit, so in a game nobody can finish they pile up past 255.
+    uint16_t counts[HAND_SLOTS];
+    uint16_t typeCounts[PRODUCTION_COUNT];
+    uint16_t cardCount;
+    
+    void clear() { memset(this, 0, sizeof(*this)); }
+    size_t size() const { return cardCount; }
+    // the first card a cardMask_t covers.  Only Research and Microbiotics (which have no hand limit) can
+    // pile up past what a mask holds, and then it covers the most valuable cards, which are plenty to pay with.
+    size_t maskBase() const { return cardCount > MAX_CARDS_IN_MASK? cardCount - MAX_CARDS_IN_MASK : 0; }
+    // includes any proxy and Mega cards.
+    amt_t countOf(productionEnum_t t) const { return typeCounts[t]; }
+    
+    static const card_t &slotCard(size_t slot) { return handSlots.cards[slot]; }
+    static size_t slotOf(const card_t &c) {
+        byte_t slot = handSlots.lookup[c.prodType][c.value][c.returnToDiscard];
+        assert(slot != NO_SLOT);
+        return slot;
+    }
+    amt_t getCount(size_t slot) const { return counts[slot]; }
+    
+    void add(const card_t &c) {
+        counts[slotOf(c)]++;
+        typeCounts[c.prodType]++;
+        cardCount++;
+    }
+    void remove(const card_t &c) {
+        size_t slot = slotOf(c);
+        assert(counts[slot]);
+        counts[slot]--;
+        typeCounts[c.prodType]--;
+        cardCount--;
+    }
+    
+    card_t operator[](cardIndex_t i) const {
+        assert(i < cardCount);
+        size_t slot = 0;
+        while (i >= counts[slot])
+            i -= counts[slot++];
+        return handSlots.cards[slot];
+    }
+    
+    // writes out every card in order from hand[first] on, returning how many.
+    size_t copyTo(card_t *out,size_t first = 0) const {
+        card_t *start = out;
+        for (size_t s=0; s<HAND_SLOTS; s++) {
+            size_t n = counts[s];
+            if (first >= n) {
+                first -= n;
+                continue;
+            }
+            for (n -= first, first = 0; n; n--)
+                *out++ = handSlots.cards[s];
+        }
+        return out - start;
+    }
+};
+
 struct player_t;
 
 bool anyHumansInGame;
 
 class brain_t {
+    // scratch table for findBestCards, kept around so searches don't allocate once it has grown.
+    struct paymentState_t {
+        int slots;              // most hand slots used by any set of cards reaching this sum, or -1 if unreachable
+        cardMask_t cards;       // which cards those are
+    };
+    vector<paymentState_t> paymentScratch;
 protected:
     string name;
     player_t *player;
-    money_t findBestCards(money_t cost,vector<card_t> &hand,amt_t minResearchCards,size_t *bestCardsOut);
+    money_t findBestCards(money_t cost,hand_t &hand,amt_t minResearchCards,cardMask_t *bestCardsOut);
+    
+    // Hand is always in sorted order.  But *never* pick a "free" card to discard.
+    static cardIndex_t cheapestDiscard(const hand_t &hand) {
+        cardIndex_t i = 0;
+        for (size_t s=0; hand_t::slotCard(s).handSize == 0 || !hand.getCount(s); s++)
+            i += hand.getCount(s);
+        return i;
+    }
 public:
     brain_t(string n) : name(n) { }
     virtual ~brain_t() { }
     const string& getName() const { return name; }
-    void setPlayer(player_t &p) { player = &p; }
+    virtual void setPlayer(player_t &p) { player = &p; }
 
-    void displayProductionCards(vector<card_t> &hand,size_t annotateMask = 0) {
-        for (cardIndex_t i=0; i<hand.size(); i++,annotateMask>>=1)
-            active << i << ". " << (annotateMask&1?"*":"") << factoryNames[hand[i].prodType] << "/" << int(hand[i].value) << "\n";
+    void displayProductionCards(const hand_t &hand,cardMask_t annotateMask = 0) {
+        for (cardIndex_t i=0; i<hand.size(); i++) {
+            bool annotate = i >= hand.maskBase() && (annotateMask >> (i - hand.maskBase()) & 1);
+            active << i << ". " << (annotate?"*":"") << factoryNames[hand[i].prodType] << "/" << int(hand[i].value) << "\n";
+        }
     }
 
-    void displayProductionCardsOnSingleLine(vector<card_t> &hand,size_t annotateMask = 0) {
+    void displayProductionCardsOnSingleLine(const hand_t &hand,cardMask_t annotateMask = 0) {
         if (hand.size()) {
             active << "[";
-            for (cardIndex_t i=0; i<hand.size(); i++,annotateMask>>=1)
-                active << (annotateMask&1?" *":" ") << factoryNames[hand[i].prodType] << "/" << int(hand[i].value);
+            for (cardIndex_t i=0; i<hand.size(); i++) {
+                bool annotate = i >= hand.maskBase() && (annotateMask >> (i - hand.maskBase()) & 1);
+                active << (annotate?" *":" ") << factoryNames[hand[i].prodType] << "/" << int(hand[i].value);
+            }
             active << " ]\n";
         }
         else
@@ -412,104 +871,444 @@ public:
     }
 
     virtual amt_t wantMega(productionEnum_t which,amt_t maxMega) = 0;
-    virtual cardIndex_t pickDiscard(vector<card_t> &hand) = 0;
-    virtual cardIndex_t pickCardToAuction(vector<card_t> &hand,vector<upgradeEnum_t> &upgradeMarket,money_t &bid) = 0;
-    virtual money_t raiseOrPass(player_t& highBidder,vector<card_t> &hand,upgradeEnum_t upgrade,money_t bid) = 0;
-    virtual money_t payFor(money_t cost,vector<card_t> &hand,bank_t &bank,amt_t minimumResearchCards); // returns actual amount paid which may be higher
+    virtual cardIndex_t pickDiscard(hand_t &hand) = 0;
+    virtual cardIndex_t pickCardToAuction(hand_t &hand,vector<upgradeEnum_t> &upgradeMarket,money_t &bid) = 0;
+    virtual money_t raiseOrPass(player_t& highBidder,hand_t &hand,upgradeEnum_t upgrade,money_t bid) = 0;
+    virtual money_t payFor(money_t cost,hand_t &hand,bank_t &bank,amt_t minimumResearchCards); // returns actual amount paid which may be higher
     virtual amt_t purchaseFactories(const vector<byte_t> &maxByType,productionEnum_t &whichFactory) = 0;
     virtual amt_t purchaseColonists(money_t perColonist,amt_t maxAllowed) = 0;
     virtual amt_t purchaseRobots(money_t perRobot,amt_t maxAllowed,amt_t maxUsable) = 0;
     virtual void assignPersonnel();
     virtual void moveOperatorToNewFactory(productionEnum_t newFactory);
     virtual void plan(turnphase_t) { }
+    // told about each card as it leaves the hand, just before it goes.
+    virtual void discarding(cardIndex_t) { }
 };
 
-typedef vector<card_t>::iterator cardIt_t;
 typedef fixedvector<byte_t,PRODUCTION_COUNT> factoryArray_t;
 typedef fixedvector<byte_t,PRODUCTION_COUNT+1> operatorArray_t;
 typedef fixedvector<byte_t,UPGRADE_COUNT> upgradeArray_t;
 
-struct player_t {
-    vector<card_t> hand;
+// Steps of a player's turn, in order.
+enum turnStage_t {
+    TURN_STARTING,
+    TURN_AUCTIONS,      // choosing upgrades to put up for auction
+    TURN_BIDDING,       // an auction is in progress
+    TURN_FACTORIES,
+    TURN_COLONISTS,
+    TURN_ROBOTS,
+    TURN_PERSONNEL
+};
+
+// Where a game is within the current round, precise enough that a game restored from a snapshot taken
+// while any brain was being asked something picks up by asking it again.  See game_t::resume.
+struct gameCursor_t {
+    uint16_t round;
+    byte_t turn;                // index into playerOrder of the player whose turn it is
+    byte_t stage;               // turnStage_t
+    // the auction in progress during TURN_BIDDING
+    byte_t upgrade, highBidder, bidder, passesInARow;
+    money_t bid;
+};
+
+// What happened, for the event log.  Which fields of gameEvent_t mean what depends on the type:
+enum eventEnum_t {
+    EVENT_GAME,         // count = players, seed (in place of amount); starts each game in a log
+    EVENT_ERA,          // amount = new era
+    EVENT_MARKET,       // what = upgrade added to the market
+    EVENT_DRAW,         // what = production type, count = hand slots (4 for a mega), amount = value
+    EVENT_SPEND,        // card given up in payment; same fields as EVENT_DRAW
+    EVENT_DISCARD,      // card discarded over the production limit; same fields as EVENT_DRAW
+    EVENT_AUCTION,      // what = upgrade, amount = opening bid
+    EVENT_BID,          // what = upgrade, amount = new high bid
+    EVENT_PASS,         // what = upgrade
+    EVENT_UPGRADE,      // what = upgrade, amount = winning bid, before any discount
+    EVENT_FACTORIES,    // what = production type, count = bought, amount = cost
+    EVENT_COLONISTS,    // count = bought, amount = cost
+    EVENT_ROBOTS,       // count = bought, amount = cost
+    EVENT_STAFF,        // what = production type, count = colonists, amount = robots; after each turn's assignments
+    EVENT_RANK,         // what = final rank, amount = VPs
+    EVENT_COUNT
+};
+
+static const char *eventNames[EVENT_COUNT] = { "game", "era", "market", "draw", "spend", "discard", "auction", "bid", "pass",
+    "upgrade", "factories", "colonists", "robots", "staff", "rank" };
+
+static const char *turnStageNames[] = { "starting", "auctions", "bidding", "factories", "colonists", "robots", "personnel" };
+
+// for events that don't belong to any player
+static const byte_t NO_PLAYER = 0xFF;
+
+// One record of the event log.  Binary logs are these, in host byte order, after an eventLogHeader_t.
+struct gameEvent_t {
+    uint16_t round;
+    byte_t type;        // eventEnum_t
+    byte_t player;      // seat, or NO_PLAYER
+    byte_t stage;       // turnStage_t; round setup happens in TURN_STARTING
+    byte_t what;
+    byte_t count;
+    byte_t reserved;
+    union {
+        int32_t amount;
+        uint32_t seed;  // EVENT_GAME
+    };
+};
+
+static_assert(sizeof(gameEvent_t) == 12, "gameEvent_t is a file format");
+
+struct eventLogHeader_t {
+    char magic[4];      // "OPEV"
+    uint16_t version, recordSize;
+};
+
+static const uint16_t EVENT_LOG_VERSION = 1;
+
+// Typed record of everything that happens in a game, kept alongside the narration.  Nothing is kept
+// unless recording is turned on; events pile up in memory until written out, normally once per game.
+class eventLog_t {
+    vector<gameEvent_t> pending;
+    bool recording;
+public:
+    eventLog_t() : recording(false) { }
+    
+    void setRecording(bool r) { recording = r; }
+    bool isRecording() const { return recording; }
+    
+    void record(const gameCursor_t &cursor,playerIndex_t player,eventEnum_t type,unsigned what,unsigned count,int amount) {
+        if (!recording)
+            return;
+        gameEvent_t e = { cursor.round, byte_t(type), byte_t(player), cursor.stage, byte_t(what), byte_t(count), 0, amount };
+        pending.push_back(e);
+    }
+    
+    void beginGame(unsigned seed,playerIndex_t playerCount) {
+        gameCursor_t start;
+        memset(&start, 0, sizeof(start));
+        record(start,NO_PLAYER,EVENT_GAME,0,playerCount,0);
+        if (recording)
+            pending.back().seed = seed;
+    }
+    
+    static void writeHeader(outputSink_t &sink) {
+        eventLogHeader_t h = { { 'O','P','E','V' }, EVENT_LOG_VERSION, sizeof(gameEvent_t) };
+        sink.write((const char*)&h, sizeof(h));
+    }
+    
+    // Writes and forgets everything recorded so far.
+    void writeBinary(outputSink_t &sink) {
+        if (pending.size())
+            sink.write((const char*)&pending[0], pending.size() * sizeof(gameEvent_t));
+        pending.clear();
+    }
+    
+    // Same, but as one JSON object per line.
+    void writeJson(outputSink_t &sink) {
+        for (size_t i=0; i<pending.size(); i++) {
+            const gameEvent_t &e = pending[i];
+            char line[256];
+            int len = snprintf(line, sizeof(line), "{\"round\":%u,\"event\":\"%s\",\"stage\":\"%s\"", e.round, eventNames[e.type], turnStageNames[e.stage]);
+            if (e.player != NO_PLAYER)
+                len += snprintf(line + len, sizeof(line) - len, ",\"player\":%u", e.player);
+            const char *what = NULL;
+            switch (e.type) {
+                case EVENT_MARKET: case EVENT_AUCTION: case EVENT_BID: case EVENT_PASS: case EVENT_UPGRADE:
+                    what = upgradeNames[e.what];
+                    break;
+                case EVENT_DRAW: case EVENT_SPEND: case EVENT_DISCARD: case EVENT_FACTORIES: case EVENT_STAFF:
+                    what = factoryNames[e.what];
+                    break;
+                case EVENT_RANK:
+                    len += snprintf(line + len, sizeof(line) - len, ",\"rank\":%u", e.what + 1);
+                    break;
+            }
+            if (what)
+                len += snprintf(line + len, sizeof(line) - len, ",\"what\":\"%s\"", what);
+            if (e.type == EVENT_GAME)
+                snprintf(line + len, sizeof(line) - len, ",\"count\":%u,\"amount\":%u}\n", e.count, e.seed);
+            else
+                snprintf(line + len, sizeof(line) - len, ",\"count\":%u,\"amount\":%d}\n", e.count, e.amount);
+            sink.write(line, strlen(line));
+        }
+        pending.clear();
+    }
+    
+    void clear() { pending.clear(); }
+};
+
+thread_local eventLog_t events;
+
+static const money_t ROBOT_PRICE = 10;
+
+// Why personnel can't be moved somewhere, if they can't; see playerState_t::checkTransfer.
+enum transferCheck_t {
+    TRANSFER_OK,
+    TRANSFER_NO_SOURCE,             // not that many there, or no such place
+    TRANSFER_NO_ROOM,               // no such factory, or not enough of them standing idle
+    TRANSFER_ROBOT_LIMIT,
+    TRANSFER_ROBOT_SPECIAL,         // robots can't operate the era 3 factories
+    TRANSFER_OVER_COLONIST_LIMIT    // colonists allowed for by the era 3 factories can't leave them for ordinary ones
+};
+
+// Everything about a player except their brain; plain data so game snapshots can copy it wholesale.
+// What the rules let a player do is worked out from this alone, so that player_t and legalActions agree.
+struct playerState_t {
+    hand_t hand;
     byte_t colonists, colonistLimit, extraColonistLimit, robots, productionSize, productionLimit, expectedProductionSize;
     money_t totalCredits, totalUpgradeCosts, averageIncome;
     factoryArray_t factories;
     operatorArray_t mannedByColonists;
     operatorArray_t mannedByRobots;
     upgradeArray_t upgrades;
-    brain_t *brain;
-
-    player_t() {
-        colonists = 3;
-        colonistLimit = 5;
-        extraColonistLimit = 0;
-        robots = 0; // active robots limit is colonistLimit times number of robotics upgrades.
-        productionLimit = 10;
-        productionSize = 0;
-        // the last element of these two arrays is used to hold personnnel not assigned to any factory
-        totalCredits = 0;
-        totalUpgradeCosts = 0;
-        brain = 0;
-
-        factories.fill(0);
-        mannedByColonists.fill(0);
-        mannedByRobots.fill(0);
-        upgrades.fill(0);
-        
-        factories[ORE] = 2;
-        mannedByColonists[ORE] = 2;
-        factories[WATER] = 1;
-        mannedByColonists[WATER] = 1;
-        
-        computeExpectedIncome();
+    unsigned victoryPoints;     // kept current as upgrades are bought and personnel move; see computeVictoryPoints
+    
+    amt_t getRobotLimit() const { return upgrades[ROBOTICS] * (colonistLimit + extraColonistLimit); }
+    
+    amt_t getRobotsInUse() const { 
+        amt_t result = 0;
+        // robots cannot ever be in era 3 upgrades.
+        for (int i=ORE; i<ORBITAL_MEDICINE; i++)
+            result += mannedByRobots[i];
+        return result;
     }
     
-      ~player_t() {
-        delete brain;
+    money_t computeDiscount(upgradeEnum_t upgrade) const {
+        const upgradeDiscount_t &d = upgradeDiscounts[upgrade];
+        return d.per[0] * upgrades[d.from[0]] + d.per[1] * upgrades[d.from[1]];
     }
-
-    void setBrain(brain_t &b) {
-        if (brain)
-            delete brain;
-        brain = &b;
+    
+    void getExpectedMoneyInHand(money_t &minPossible,money_t &maxPossible) const {
+        minPossible = 0;
+        maxPossible = 0;
+        for (size_t s=0; s<HAND_SLOTS; s++) {
+            const card_t &c = hand_t::slotCard(s);
+            // if it's returned to discard we cannot know what it may be.
+            // if it's not returned to discard it's an "average" card or mega card, either way we know its exact value
+            const deckSpec_t &spec = deckSpecs[c.prodType];
+            minPossible += hand.getCount(s) * (c.returnToDiscard? spec.dist[0].value : c.value);
+            maxPossible += hand.getCount(s) * (c.returnToDiscard? spec.dist[spec.count - 1].value : c.value);
+        }
     }
-
-    void addCard(productionDeck_t &fromDeck) {
-        addCard(fromDeck.drawCard());
+    
+    // How many of each type of factory could be bought; outFactories must hold PRODUCTION_COUNT entries.
+    void getMaxFactories(byte_t *outFactories) const {
+        fill(outFactories, outFactories + PRODUCTION_COUNT, 0);
+        outFactories[ORE] = totalCredits / factoryCosts[ORE];
+        outFactories[WATER] = totalCredits / factoryCosts[WATER];
+        if (upgrades[HEAVY_EQUIPMENT])
+            outFactories[TITANIUM] = totalCredits / factoryCosts[TITANIUM];
+        if (upgrades[LABORATORY])
+            outFactories[RESEARCH] = totalCredits / factoryCosts[RESEARCH];
+        // Each new chemicals factory must be paid for with at least one research card
+        int numResearch = hand.countOf(RESEARCH);
+        outFactories[NEW_CHEMICALS] = totalCredits / factoryCosts[NEW_CHEMICALS];
+        if (outFactories[NEW_CHEMICALS] > numResearch)
+            outFactories[NEW_CHEMICALS] = numResearch;
+        // MICROBIOTICS, ORBITAL_MEDICINE, RING_ORE, and MOON_ORE factories are never
+        // directly purchased; they are part of upgrade purchases.
     }
-
-    void addCard(card_t newCard) {
-        hand.push_back(newCard);
-        productionSize += newCard.handSize;
-        totalCredits += newCard.value;
+    
+    // special case - on the first turn all six starting cards can be traded in for a water factory even if they don't add up to one.
+    bool canTradeInForWater(bool firstTurn) const {
+        return firstTurn && totalCredits < factoryCosts[WATER] && hand.size() == 6;
     }
     
-    void discardCard(bank_t &bank,cardIndex_t which) {
-        card_t discard = hand[which];
-        // erase the card from hand
-        hand.erase(hand.begin() + which);
-        productionSize -= discard.handSize;
-        totalCredits -= discard.value;
-        if (discard.returnToDiscard)  // mega cards (and virtual cards) don't go into same deck
-            bank[discard.prodType].discardCard(discard.value);
+    money_t getColonistPrice() const { return upgrades[ECOPLANTS]? 5: 10; }
+    
+    amt_t getMaxColonists() const {
+        if (colonists >= colonistLimit + extraColonistLimit)
+            return 0;
+        amt_t limit = colonistLimit + extraColonistLimit - colonists;
+        amt_t affordable = amt_t(totalCredits / getColonistPrice());
+        return limit < affordable? limit : affordable;
     }
-
-    void drawProductionCards(bank_t &bank,bool firstTurn) {
-        // have to decide whether to draw megaproduction cards first
-        // this isn't strictly necessary according to the rules since we don't display any cards
-        // until all have already been drawn, but it's more of a user interface issue where we
-        // have to stop and ask in the middle of displaying status text.
-        vector<byte_t> megaCount;
-        megaCount.resize(PRODUCTION_COUNT);
-        for (int i=ORE; i<PRODUCTION_COUNT; i++) {
-            int maxMega = (mannedByColonists[i] + mannedByRobots[i]) / 4;
-            if (bank[i].getMegaValue() && maxMega)
-                megaCount[i] = brain->wantMega((productionEnum_t)i,maxMega);
-        }
-                         
-        table << getName() << " draws ";
-        bool firstCard = true;
-        for (int i=ORE; i<PRODUCTION_COUNT; i++) {
+    
+    // you must have ROBOTICS in order to buy any.  there is no limit to how many you can buy,
+    // but you can only operate one per colonist per ROBOTICS upgrade owned.
+    amt_t getMaxRobots() const { return upgrades[ROBOTICS]? totalCredits / ROBOT_PRICE : 0; }
+    
+    transferCheck_t checkTransfer(bool robot,int from,int to,amt_t count) const {
+        const operatorArray_t &crew = robot? mannedByRobots : mannedByColonists;
+        if (from < ORE || from > UNUSED || crew[from] < count)
+            return TRANSFER_NO_SOURCE;
+        if (to < ORE || to > UNUSED || (to != UNUSED && factories[to] < mannedByColonists[to] + mannedByRobots[to] + count))
+            return TRANSFER_NO_ROOM;
+        if (to != UNUSED && from == UNUSED && robot && getRobotsInUse() + count > getRobotLimit())
+            return TRANSFER_ROBOT_LIMIT;
+        if (to >= ORBITAL_MEDICINE && to <= MOON_ORE && robot)
+            return TRANSFER_ROBOT_SPECIAL;
+        if (!robot && from >= ORBITAL_MEDICINE && to < ORBITAL_MEDICINE && colonists > colonistLimit)
+            return TRANSFER_OVER_COLONIST_LIMIT;
+        return TRANSFER_OK;
+    }
+    
+    // Moves count colonists or robots (whichever crew is) between factories and/or the unused pool.
+    void transferOperators(operatorArray_t &crew,int from,int to,amt_t count) {
+        crew[from] -= count;
+        crew[to] += count;
+        victoryPoints += count * vpsForMannedFactory[to];
+        victoryPoints -= count * vpsForMannedFactory[from];
+    }
+    
+    // From scratch; only needed when personnel have been replaced wholesale, or to check a checkpoint.
+    unsigned computeVictoryPoints() const {
+        unsigned vps = 0;
+        // compute victory points for static upgrades
+        for (int i=DATA_LIBRARY; i<UPGRADE_COUNT; i++)
+            vps += vpsForUpgrade[i] * upgrades[i];
+        // now include victory points for factories which are manned
+        // note that microbiotics is counted during upgrades and can never be manned.
+        // scientists are counted during upgrades as well but you can also buy/man research factories so they're counted here.
+        for (int i=ORE; i<PRODUCTION_COUNT; i++)
+            vps += vpsForMannedFactory[i] * (mannedByColonists[i] + mannedByRobots[i]);
+        return vps;
+    }
+
+    void removeCard(const card_t &card) {
+        hand.remove(card);
+        productionSize -= card.handSize;
+        totalCredits -= card.value;
+    }
+    
+    // Returns the factory that came with the upgrade, which still needs somebody to operate it, or PRODUCTION_COUNT.
+    productionEnum_t addUpgrade(upgradeEnum_t upgrade) {
+        upgrades[upgrade]++;
+        victoryPoints += vpsForUpgrade[upgrade];
+        // this is used for breaking ties on victory points
+        totalUpgradeCosts += upgradeCosts[upgrade];
+        
+        // implement purchase bonuses
+        productionEnum_t newFactory = PRODUCTION_COUNT;
+        if (upgrade == WAREHOUSE)
+            productionLimit += 5;
+        else if (upgrade == NODULE)
+            colonistLimit += 3;
+        else if (upgrade == ROBOTICS) {
+            robots++;
+            mannedByRobots[UNUSED]++;
+        }
+        else if (upgrade == LABORATORY)
+            newFactory = RESEARCH;
+        else if (upgrade == OUTPOST) {
+            colonistLimit += 5;
+            productionLimit += 5;
+            newFactory = TITANIUM;
+        }
+        // the last three upgrades are all special factories that must be manned
+        // but also can be manned regardless of the population limit.
+        else if (upgrade >= SPACE_STATION) {
+            newFactory = productionEnum_t(upgrade - SPACE_STATION + ORBITAL_MEDICINE);
+            extraColonistLimit++;
+        }
+        if (newFactory != PRODUCTION_COUNT)
+            factories[newFactory]++;
+        return newFactory;
+    }
+    
+    void computeExpectedIncome() {
+        expectedProductionSize = 0;
+        averageIncome = 0;
+        // Assume we'll be throwing out the worst cards if we're producing more than we can hold,
+        // which are always those of the cheapest decks (but research and microbiotics never count against hand limit)
+        amt_t slots = productionLimit;
+        for (int i=MOON_ORE; i>=ORE; i--) {
+            amt_t cards = mannedByColonists[i] + mannedByRobots[i];
+            if (i==RESEARCH)
+                cards += upgrades[SCIENTISTS];
+            else if (i==MICROBIOTICS)
+                cards += upgrades[ORBITAL_LAB];
+            if (deckSpecs[i].countsInHandSize) {
+                expectedProductionSize += cards;
+                if (cards > slots)
+                    cards = slots;
+                slots -= cards;
+            }
+            averageIncome += expectedCardValue(productionEnum_t(i),cards);
+        }
+    }
+};
+
+struct player_t: public playerState_t {
+    brain_t *brain;
+    // where this player sits and the game's cursor, so that what they do can be logged.
+    playerIndex_t seat;
+    const gameCursor_t *cursor;
+
+    player_t() {
+        colonists = 3;
+        colonistLimit = 5;
+        extraColonistLimit = 0;
+        robots = 0; // active robots limit is colonistLimit times number of robotics upgrades.
+        productionLimit = 10;
+        productionSize = 0;
+        // the last element of these two arrays is used to hold personnnel not assigned to any factory
+        totalCredits = 0;
+        totalUpgradeCosts = 0;
+        brain = 0;
+        seat = 0;
+        cursor = 0;
+
+        hand.clear();
+        factories.fill(0);
+        mannedByColonists.fill(0);
+        mannedByRobots.fill(0);
+        upgrades.fill(0);
+        
+        factories[ORE] = 2;
+        mannedByColonists[ORE] = 2;
+        factories[WATER] = 1;
+        mannedByColonists[WATER] = 1;
+        victoryPoints = computeVictoryPoints();
+        
+        computeExpectedIncome();
+    }
+    
+      ~player_t() {
+        delete brain;
+    }
+
+    void setBrain(brain_t &b) {
+        if (brain)
+            delete brain;
+        brain = &b;
+    }
+
+    void addCard(productionDeck_t &fromDeck,rng_t &rng) {
+        addCard(fromDeck.drawCard(rng));
+    }
+
+    void addCard(card_t newCard) {
+        events.record(*cursor,seat,EVENT_DRAW,newCard.prodType,newCard.handSize,newCard.value);
+        hand.add(newCard);
+        productionSize += newCard.handSize;
+        totalCredits += newCard.value;
+    }
+    
+    // cards are discarded either to pay for something or because there are too many of them.
+    void discardCard(bank_t &bank,cardIndex_t which,bool spent = true) {
+        card_t discard = hand[which];
+        brain->discarding(which);
+        events.record(*cursor,seat,spent? EVENT_SPEND : EVENT_DISCARD,discard.prodType,discard.handSize,discard.value);
+        removeCard(discard);
+        if (discard.returnToDiscard)  // mega cards (and virtual cards) don't go into same deck
+            bank[discard.prodType].discardCard(discard.value);
+    }
+
+    void drawProductionCards(bank_t &bank,rng_t *deckRngs,bool firstTurn) {
+        // have to decide whether to draw megaproduction cards first
+        // this isn't strictly necessary according to the rules since we don't display any cards
+        // until all have already been drawn, but it's more of a user interface issue where we
+        // have to stop and ask in the middle of displaying status text.
+        vector<byte_t> megaCount;
+        megaCount.resize(PRODUCTION_COUNT);
+        for (int i=ORE; i<PRODUCTION_COUNT; i++) {
+            int maxMega = (mannedByColonists[i] + mannedByRobots[i]) / 4;
+            if (bank[i].getMegaValue() && maxMega)
+                megaCount[i] = brain->wantMega((productionEnum_t)i,maxMega);
+        }
+                         
+        table << getName() << " draws ";
+        bool firstCard = true;
+        for (int i=ORE; i<PRODUCTION_COUNT; i++) {
             int toDraw = mannedByColonists[i] + mannedByRobots[i];
             // special cases: each scientist upgrade produces a research card without being populated.
             // same for microbiotics.
@@ -534,7 +1333,7 @@ struct player_t {
                 firstCard = false;
             }
             while (toDraw) {
-                addCard(bank[i]);
+                addCard(bank[i],deckRngs[i]);
                 --toDraw;
             }
         }
@@ -542,95 +1341,25 @@ struct player_t {
             table << " no production cards!\n";
         else
             table << ".\n";
-        sort(hand.begin(),hand.end());
     }
     
     void discardExcessProductionCards(bank_t &bank) {
         amt_t discarded = 0;
         while (productionSize > productionLimit) {
-            discardCard(bank,brain->pickDiscard(hand));
+            discardCard(bank,brain->pickDiscard(hand),false);
             ++discarded;    // some cards take four slots
         }
         if (discarded)
             table << getName() << " discarded " << discarded << " production card" << (discarded>1?"s":"") << ".\n";
     }
     
-    amt_t getRobotLimit() const { return upgrades[ROBOTICS] * (colonistLimit + extraColonistLimit); }
-    
-    amt_t getRobotsInUse() const { 
-        amt_t result = 0;
-        // robots cannot ever be in era 3 upgrades.
-        for (int i=ORE; i<ORBITAL_MEDICINE; i++)
-            result += mannedByRobots[i];
-        return result;
-    }
-        
-    void newFactoryFromUpgrade(productionEnum_t which) {
-        factories[which]++;
-        brain->moveOperatorToNewFactory(which);
-    }
-    
     void addUpgrade(upgradeEnum_t upgrade) {
-        upgrades[upgrade]++;
-        // this is used for breaking ties on victory points
-        totalUpgradeCosts += upgradeCosts[upgrade];
-        
-        // implement purchase bonuses
-        if (upgrade == WAREHOUSE)
-            productionLimit += 5;
-        else if (upgrade == NODULE)
-            colonistLimit += 3;
-        else if (upgrade == ROBOTICS) {
-            robots++;
-            mannedByRobots[UNUSED]++;
-        }
-        else if (upgrade == LABORATORY)
-            newFactoryFromUpgrade(RESEARCH);
-        else if (upgrade == OUTPOST) {
-            colonistLimit += 5;
-            productionLimit += 5;
-            newFactoryFromUpgrade(TITANIUM);
-        }
-        // the last three upgrades are all special factories that must be manned
-        // but also can be manned regardless of the population limit.
-        else if (upgrade >= SPACE_STATION) {
-            newFactoryFromUpgrade(productionEnum_t(upgrade - SPACE_STATION + ORBITAL_MEDICINE));
-            extraColonistLimit++;
-        }
+        productionEnum_t newFactory = playerState_t::addUpgrade(upgrade);
+        if (newFactory != PRODUCTION_COUNT)
+            brain->moveOperatorToNewFactory(newFactory);
     }
     
-    unsigned computeVictoryPoints() {
-        unsigned vps = 0;
-        // compute victory points for static upgrades
-        for (int i=DATA_LIBRARY; i<UPGRADE_COUNT; i++)
-            vps += vpsForUpgrade[i] * upgrades[i];
-        // now include victory points for factories which are manned
-        // note that microbiotics is counted during upgrades and can never be manned.
-        // scientists are counted during upgrades as well but you can also buy/man research factories so they're counted here.
-        for (int i=ORE; i<PRODUCTION_COUNT; i++)
-            vps += vpsForMannedFactory[i] * (mannedByColonists[i] + mannedByRobots[i]);
-        return vps;
-    }
-
-    void getMaxFactories(vector<byte_t> &outFactories) {
-        outFactories.clear();
-        outFactories.resize(PRODUCTION_COUNT);
-        outFactories[ORE] = totalCredits / factoryCosts[ORE];
-        outFactories[WATER] = totalCredits / factoryCosts[WATER];
-        if (upgrades[HEAVY_EQUIPMENT])
-            outFactories[TITANIUM] = totalCredits / factoryCosts[TITANIUM];
-        if (upgrades[LABORATORY])
-            outFactories[RESEARCH] = totalCredits / factoryCosts[RESEARCH];
-        // Each new chemicals factory must be paid for with at least one research card
-        int numResearch = 0;
-        for (cardIt_t i=hand.begin(); i!=hand.end(); i++)
-            numResearch += (i->prodType == RESEARCH);
-        outFactories[NEW_CHEMICALS] = totalCredits / factoryCosts[NEW_CHEMICALS];
-        if (outFactories[NEW_CHEMICALS] > numResearch)
-            outFactories[NEW_CHEMICALS] = numResearch;
-        // MICROBIOTICS, ORBITAL_MEDICINE, RING_ORE, and MOON_ORE factories are never
-        // directly purchased; they are part of upgrade purchases.
-    }
+    unsigned getVictoryPoints() const { return victoryPoints; }
     
     void payFor(money_t cost,bank_t &bank,int minResearchCards) {
         brain->payFor(cost,hand,bank,minResearchCards);
@@ -647,11 +1376,10 @@ struct player_t {
     void purchaseFactories(bool firstTurn,bank_t &bank) {
         brain->plan(BUYING_FACTORIES);
         for (;;) {
-            vector<byte_t> forPurchase;
-            getMaxFactories(forPurchase);
+            vector<byte_t> forPurchase(PRODUCTION_COUNT);
+            getMaxFactories(&forPurchase[0]);
             productionEnum_t whichFactory;
-            // special case - on first turn we can trade in all cards for a water factory even if we couldn't normally afford one.
-            if (firstTurn && !forPurchase[WATER] && hand.size() == 6)
+            if (canTradeInForWater(firstTurn))
                 forPurchase[WATER] = 1;
             // otherwise if we cannot afford any ore, don't bother asking
             else if (!forPurchase[ORE])
@@ -663,8 +1391,10 @@ struct player_t {
             amt_t numToBuy = brain->purchaseFactories(forPurchase,whichFactory);
             if (numToBuy) {
                 // if it's the first turn water special case, pay what we have instead of its actual cost
-                brain->payFor(firstTurn&&whichFactory==WATER? totalCredits : numToBuy * factoryCosts[whichFactory],hand,bank,whichFactory==NEW_CHEMICALS? numToBuy : 0);
+                money_t cost = firstTurn&&whichFactory==WATER? totalCredits : numToBuy * factoryCosts[whichFactory];
+                brain->payFor(cost,hand,bank,whichFactory==NEW_CHEMICALS? numToBuy : 0);
                 table << getName() << " bought " << numToBuy << " " << factoryNames[whichFactory] << " factor" << (numToBuy>1?"ies":"y") << ".\n";
+                events.record(*cursor,seat,EVENT_FACTORIES,whichFactory,numToBuy,cost);
                 factories[whichFactory] += numToBuy;
                 // when we cycle up again there will be no special case.
             }
@@ -674,37 +1404,45 @@ struct player_t {
         computeExpectedIncome();
     }
     
-    void purchaseAndAssignPersonnel(bank_t &bank) {
+    void purchaseColonists(bank_t &bank) {
         if (colonists < colonistLimit + extraColonistLimit) {
             brain->plan(BUYING_COLONISTS);
-            money_t price = upgrades[ECOPLANTS]? 5: 10;
-            amt_t limit = colonistLimit + extraColonistLimit - colonists;
-            if (limit > totalCredits / price)
-                limit = totalCredits / price;
+            money_t price = getColonistPrice();
+            amt_t limit = getMaxColonists();
             amt_t purchased = limit? brain->purchaseColonists(price,limit) : 0;
             if (purchased) {
                 table << getName() << " bought " << purchased << " colonist" << (purchased>1?"s":"") << ".\n";
+                events.record(*cursor,seat,EVENT_COLONISTS,0,purchased,purchased * price);
                 colonists += purchased;
                 mannedByColonists[UNUSED] += purchased;
                 payFor(purchased * price,bank,0);
             }
         }
-        // you must have ROBOTICS in order to buy any.  there is no limit to how many you can buy,
-        // but you can only operate one per colonist per ROBOTICS upgrade owned.
+    }
+    
+    void purchaseRobots(bank_t &bank) {
         if (upgrades[ROBOTICS]) {
             brain->plan(BUYING_ROBOTS);
-            money_t price = 10;
-            amt_t limit = totalCredits / price;
-            amt_t purchased = limit? brain->purchaseRobots(price,limit,(upgrades[ROBOTICS] * (colonistLimit + extraColonistLimit)) - robots) : 0;
+            money_t price = ROBOT_PRICE;
+            amt_t limit = getMaxRobots();
+            amt_t purchased = limit? brain->purchaseRobots(price,limit,getRobotLimit() - robots) : 0;
             if (purchased) {
                 table << getName() << " bought " << purchased << " robot" << (purchased>1?"s":"") << ".\n";
+                events.record(*cursor,seat,EVENT_ROBOTS,0,purchased,purchased * price);
                 robots += purchased;
                 mannedByRobots[UNUSED] += purchased;
                 payFor(purchased * price,bank,0);
             }
         }        
+    }
+    
+    void assignPersonnel() {
         brain->assignPersonnel();
         computeExpectedIncome();
+        if (events.isRecording())
+            for (int i=ORE; i<PRODUCTION_COUNT; i++)
+                if (factories[i])
+                    events.record(*cursor,seat,EVENT_STAFF,i,mannedByColonists[i],mannedByRobots[i]);
     }
     
     void displayHoldings() {
@@ -724,35 +1462,10 @@ struct player_t {
     
     const string& getName() const { return brain->getName(); }
     
-    money_t computeDiscount(upgradeEnum_t upgrade) const {
-        if (upgrade == SCIENTISTS || upgrade == LABORATORY)
-            return upgrades[DATA_LIBRARY] * 10;
-        else if (upgrade == WAREHOUSE || upgrade == NODULE)
-            return upgrades[HEAVY_EQUIPMENT] * 5;
-        else if (upgrade == OUTPOST)
-            return upgrades[HEAVY_EQUIPMENT] * 15 + upgrades[ECOPLANTS] * 10;
-        else
-            return 0;
-    }
-    
     money_t getTotalCredits() const { return totalCredits; }
     
     money_t getTotalUpgradeCosts() const { return totalUpgradeCosts; }
     
-    void getExpectedMoneyInHand(money_t &minPossible,money_t &maxPossible) const {
-        static const byte_t minPerCard[PRODUCTION_COUNT] = { 1,4,7,9,14,14,20,30,40 };
-        static const byte_t maxPerCard[PRODUCTION_COUNT] = { 5,10,13,17,20,26,40,50,60 };
-        
-        minPossible = 0;
-        maxPossible = 0;
-        for (vector<card_t>::const_iterator c=hand.begin(); c!=hand.end(); c++) {
-            // if it's returned to discard we cannot know what it may be.
-            // if it's not returned to discard it's an "average" card or mega card, either way we know its exact value
-            minPossible += c->returnToDiscard? minPerCard[c->prodType] : c->value;
-            maxPossible += c->returnToDiscard? maxPerCard[c->prodType] : c->value;
-        }
-    }
-    
     money_t getAverageIncome() const {
         return averageIncome;
     }
@@ -761,34 +1474,38 @@ struct player_t {
         return expectedProductionSize;
     }
     
-    void computeExpectedIncome() {
-        int numOre = mannedByColonists[ORE] + mannedByRobots[ORE];
-        int numWater = mannedByColonists[WATER] + mannedByRobots[WATER];
-        int numTitanium = mannedByColonists[TITANIUM] + mannedByRobots[TITANIUM];
-        int numResearch = upgrades[SCIENTISTS] + mannedByColonists[RESEARCH] + mannedByRobots[RESEARCH];
-        int numMicrobiotics = upgrades[ORBITAL_LAB];
-        int numNewChemicals = mannedByColonists[NEW_CHEMICALS] + mannedByRobots[NEW_CHEMICALS];
-        int numOrbitalMedicine = mannedByColonists[ORBITAL_MEDICINE];
-        int numRingOre = mannedByColonists[RING_ORE];
-        int numMoonOre = mannedByColonists[MOON_ORE];
-        // Assume we'll be throwing out the worst cards if we're producing more than we can hold
-        // (but research and microbiotics never count against hand limit)
-        expectedProductionSize = numOre + numWater + numTitanium + numNewChemicals + numOrbitalMedicine + numRingOre + numMoonOre;
-        while (numOre + numWater + numTitanium + numNewChemicals + numOrbitalMedicine + numRingOre + numMoonOre > productionLimit) {
-            if (numOre) --numOre;
-            else if (numWater) --numWater;
-            else if (numTitanium) --numTitanium;
-            else if (numNewChemicals) --numNewChemicals;
-            else if (numOrbitalMedicine) --numOrbitalMedicine;
-            else if (numRingOre) --numRingOre;
-            else if (numMoonOre) --numMoonOre;
-        }
-        averageIncome = 3 * numOre + 7 * numWater + 10 * numTitanium + 13 * numResearch + 17 * numMicrobiotics +
-            20 * numNewChemicals + 30 * numOrbitalMedicine + 40 * numRingOre + 50 * numMoonOre;
-        assert(averageIncome);
-    }    
 };
 
+struct playerPos_t {
+    bool operator<(const playerPos_t &that) const {
+        return vps > that.vps || (vps == that.vps && (totalUpgradeCosts > that.totalUpgradeCosts || 
+                                                      (totalUpgradeCosts == that.totalUpgradeCosts && randomNoise > that.randomNoise)));
+    }
+    unsigned vps;
+    money_t totalUpgradeCosts;
+    unsigned randomNoise;
+    playerIndex_t selfIndex;
+};
+
+// Total number of cards in all production decks combined (see deckSpecs).
+static const size_t PRODUCTION_CARD_COUNT = 239;
+
+// Complete state of a game in progress (other than the brains) as one flat, fixed-size value,
+// so cloning a game for look-ahead is a single memcpy.  See game_t::saveState and restoreState.
+struct gameState_t {
+    gameRngs_t rngs;
+    gameCursor_t cursor;
+    playerState_t players[MAX_PLAYERS];
+    playerPos_t playerOrder[MAX_PLAYERS];
+    byte_t productionCards[PRODUCTION_CARD_COUNT];  // each deck's draw pile then discards, in productionEnum_t order
+    byte_t drawPileSizes[PRODUCTION_COUNT], discardPileSizes[PRODUCTION_COUNT];
+    upgradeArray_t upgradeDrawPiles, currentMarketCounts;
+    byte_t upgradeMarket[MAX_PLAYERS];
+    byte_t marketSize, playerCount, era, marketLimit, previousMarketEmpty;
+};
+
+static_assert(is_trivially_copyable<gameState_t>::value, "gameState_t must stay plain data");
+
 class game_t {
     bank_t bank;
     upgradeArray_t upgradeDrawPiles;
@@ -796,25 +1513,22 @@ class game_t {
     upgradeArray_t currentMarketCounts;
     vector<player_t> players;
     typedef vector<player_t>::iterator playerIt_t;
-    struct playerPos_t {
-        bool operator<(const playerPos_t &that) const {
-            return vps > that.vps || (vps == that.vps && (totalUpgradeCosts > that.totalUpgradeCosts || 
-                                                          (totalUpgradeCosts == that.totalUpgradeCosts && randomNoise > that.randomNoise)));
-        }
-        unsigned vps;
-        money_t totalUpgradeCosts;
-        unsigned randomNoise;
-        playerIndex_t selfIndex;
-    };
     vector<playerPos_t> playerOrder;
     typedef vector<playerPos_t>::iterator playerOrderIt_t;
     byte_t era, marketLimit;
     bool previousMarketEmpty;
+    gameRngs_t rngs;
+    gameCursor_t cursor;
     friend class computerBrain_t;       // temporary, hopefully...
 public:
-    game_t(playerIndex_t playerCount) {
+    game_t(playerIndex_t playerCount,unsigned seed) {
         // default ctor sets up a bunch of game state
+        rngs.seed(seed);
         players.resize(playerCount);
+        for (playerIndex_t i=0; i<playerCount; i++) {
+            players[i].seat = i;
+            players[i].cursor = &cursor;
+        }
 
         era = 1;
         previousMarketEmpty = false;
@@ -822,30 +1536,60 @@ public:
         upgradeMarket.clear();
         currentMarketCounts.fill(0);
         marketLimit = playerCount >> 1;
+        memset(&cursor, 0, sizeof(cursor));
+        // decks are set up right away so that a snapshot can be restored into a fresh game.
+        setupProductionDecks();
     }
     
     const bank_t& getBank() const { return bank; }
+    
+    void saveState(gameState_t &state) const {
+        state.rngs = rngs;
+        state.cursor = cursor;
+        state.playerCount = byte_t(players.size());
+        for (playerIndex_t i=0; i<players.size(); i++) {
+            state.players[i] = players[i];
+            state.playerOrder[i] = playerOrder[i];
+        }
+        size_t productionCards = 0;
+        for (int i=ORE; i<PRODUCTION_COUNT; i++)
+            productionCards += bank[i].save(state.productionCards + productionCards, state.drawPileSizes[i], state.discardPileSizes[i]);
+        assert(productionCards <= PRODUCTION_CARD_COUNT);
+        state.upgradeDrawPiles = upgradeDrawPiles;
+        state.currentMarketCounts = currentMarketCounts;
+        state.marketSize = byte_t(upgradeMarket.size());
+        copy(upgradeMarket.begin(), upgradeMarket.end(), state.upgradeMarket);
+        state.era = era;
+        state.marketLimit = marketLimit;
+        state.previousMarketEmpty = previousMarketEmpty;
+    }
+    
+    // Brains are left as they are; the snapshot must come from a game with the same number of players.
+    void restoreState(const gameState_t &state) {
+        assert(state.playerCount == players.size());
+        rngs = state.rngs;
+        cursor = state.cursor;
+        playerOrder.resize(players.size());
+        for (playerIndex_t i=0; i<players.size(); i++) {
+            static_cast<playerState_t&>(players[i]) = state.players[i];
+            playerOrder[i] = state.playerOrder[i];
+        }
+        size_t productionCards = 0;
+        for (int i=ORE; i<PRODUCTION_COUNT; i++)
+            productionCards += bank[i].restore(state.productionCards + productionCards, state.drawPileSizes[i], state.discardPileSizes[i]);
+        upgradeDrawPiles = state.upgradeDrawPiles;
+        currentMarketCounts = state.currentMarketCounts;
+        upgradeMarket.clear();
+        for (size_t i=0; i<state.marketSize; i++)
+            upgradeMarket.push_back(upgradeEnum_t(state.upgradeMarket[i]));
+        era = state.era;
+        marketLimit = state.marketLimit;
+        previousMarketEmpty = state.previousMarketEmpty != 0;
+    }
         
     void setupProductionDecks() {
-        static const cardDistribution_t OreDeck[] = { {1,6}, {2,8}, {3,8}, {4,8}, {5,6} };
-        static const cardDistribution_t WaterDeck[] = { {4,3}, {5,5}, {6,7}, {7,9}, {8,7}, {9,5}, {10,3} };
-        static const cardDistribution_t TitaniumDeck[] = { {7,5}, {8,7}, {9,9}, {10,11}, {11,9}, {12,7}, {13,5} };
-        static const cardDistribution_t ResearchDeck[] = { {9,2}, {10,3}, {11,4}, {12,5}, {13,6}, {14,5}, {15,4}, {16,3}, {17,2} };
-        static const cardDistribution_t MicrobioticsDeck[] = { {14,1}, {15,2}, {16,3}, {17,4}, {18,3}, {19,2}, {20,1} };
-        static const cardDistribution_t NewChemicalsDeck[] = { {14,2}, {16,3}, {18,4}, {20,5}, {22,4}, {24,3}, {26,2} };
-        static const cardDistribution_t OrbitalMedicineDeck[] = { {20,2}, {25,3}, {30,4}, {35,3}, {40,2} };
-        static const cardDistribution_t RingOreDeck[] = { {30,1}, {35,3}, {40,4}, {45,3}, {50,1} };
-        static const cardDistribution_t MoonOreDeck[] = { {40,1}, {45,3}, {50,4}, {55,3}, {60,1} };
-
-        bank[ORE].init(ORE,OreDeck,NELEM(OreDeck),3,0,true);
-        bank[WATER].init(WATER,WaterDeck,NELEM(WaterDeck),7,30,true);
-        bank[TITANIUM].init(TITANIUM,TitaniumDeck,NELEM(TitaniumDeck),10,44,true);
-        bank[RESEARCH].init(RESEARCH,ResearchDeck,NELEM(ResearchDeck),13,0,false);
-        bank[MICROBIOTICS].init(MICROBIOTICS,MicrobioticsDeck,NELEM(MicrobioticsDeck),17,0,false);
-        bank[NEW_CHEMICALS].init(NEW_CHEMICALS,NewChemicalsDeck,NELEM(NewChemicalsDeck),20,88,true);
-        bank[ORBITAL_MEDICINE].init(ORBITAL_MEDICINE,OrbitalMedicineDeck,NELEM(OrbitalMedicineDeck),30,0,true);
-        bank[RING_ORE].init(RING_ORE,RingOreDeck,NELEM(RingOreDeck),40,0,true);
-        bank[MOON_ORE].init(MOON_ORE,MoonOreDeck,NELEM(MoonOreDeck),50,0,true);
+        for (int i=ORE; i<PRODUCTION_COUNT; i++)
+            bank[i].init(productionEnum_t(i),deckSpecs[i],rngs.decks[i]);
     }
 
     void setupUpgradeDecks(playerIndex_t playerCount) {
@@ -853,7 +1597,7 @@ public:
             int even = 0, odd = 0;
             int i;
             for (i=DATA_LIBRARY; i<UPGRADE_COUNT; i++) {
-                if (rand() & 1) {
+                if (rngs.market.next() & 1) {
                     upgradeDrawPiles[i]=1;
                     if (++odd == 10)
                         break;
@@ -870,20 +1614,25 @@ public:
             }
         }
         else {
-            static const byte_t upgrades_1_10[10] = { 0,0,0, 2,3,3,4,5,5,6 };
-            static const byte_t upgrades_11_13[10] = { 0,0,0, 2,3,4,4,5,6,6 };
-            for (int i=DATA_LIBRARY; i<SPACE_STATION; i++)
-                upgradeDrawPiles[i] = upgrades_1_10[playerCount];
-            for (int i=SPACE_STATION; i<UPGRADE_COUNT; i++)
-                upgradeDrawPiles[i] = upgrades_11_13[playerCount];
+            for (int i=DATA_LIBRARY; i<UPGRADE_COUNT; i++)
+                upgradeDrawPiles[i] = byte_t(getUpgradesDealt(playerCount,i));
         }
     }
+    
+    // How many of an upgrade there are in a game; with two players that's one or two, at random.
+    static amt_t getUpgradesDealt(playerIndex_t playerCount,int upgrade) {
+        static const byte_t upgrades_1_10[10] = { 0,0,0, 2,3,3,4,5,5,6 };
+        static const byte_t upgrades_11_13[10] = { 0,0,0, 2,3,4,4,5,6,6 };
+        if (playerCount == 2)
+            return 2;
+        return upgrade < SPACE_STATION? upgrades_1_10[playerCount] : upgrades_11_13[playerCount];
+    }
 
     void setInitialPlayerState(playerIndex_t playerCount) {
         // do initial production draws for each player
         for (playerIt_t i=players.begin(); i!= players.end(); i++)
             // production is doubled on first turn.
-            i->drawProductionCards(bank,true);
+            i->drawProductionCards(bank,rngs.decks,true);
         
         // randomly assign player order on first turn
         // (the random noise will be sole deciding factor)
@@ -892,7 +1641,6 @@ public:
 
 
     void setupGame() {
-        setupProductionDecks();
         setupUpgradeDecks(players.size());
         setInitialPlayerState(players.size());
         replaceUpgradeCards();
@@ -904,15 +1652,31 @@ public:
     }
   
    
+    // Turn order only changes between rounds, and then not by much, so last round's order is brought
+    // up to date with an insertion sort (in ascending order, using operator<).
     void computeVictoryPoints() {
-        playerOrder.clear();
-        playerOrder.reserve(players.size());
-        for (playerIndex_t i=0; i<players.size(); i++) {
-            playerPos_t p = { players[i].computeVictoryPoints(), players[i].getTotalUpgradeCosts(), rand(), i };
-            playerOrder.push_back(p);
+        if (playerOrder.size() != players.size()) {
+            playerOrder.resize(players.size());
+            for (playerIndex_t i=0; i<players.size(); i++)
+                playerOrder[i].selfIndex = i;
+        }
+        // the noise is drawn in seat order whatever the current order is
+        unsigned noise[MAX_PLAYERS];
+        for (playerIndex_t i=0; i<players.size(); i++)
+            noise[i] = rngs.noise.next();
+        for (playerIndex_t i=0; i<playerOrder.size(); i++) {
+            playerPos_t &p = playerOrder[i];
+            p.vps = players[p.selfIndex].getVictoryPoints();
+            p.totalUpgradeCosts = players[p.selfIndex].getTotalUpgradeCosts();
+            p.randomNoise = noise[p.selfIndex];
+        }
+        for (playerIndex_t i=1; i<playerOrder.size(); i++) {
+            playerPos_t p = playerOrder[i];
+            playerIndex_t j = i;
+            for (; j && p < playerOrder[j-1]; j--)
+                playerOrder[j] = playerOrder[j-1];
+            playerOrder[j] = p;
         }
-        // sort in ascending order (default uses operator<)
-        sort(playerOrder.begin(),playerOrder.end());
     }
     
     void displayPlayerOrder() {
@@ -955,10 +1719,12 @@ public:
         if (era == 1 && (playerOrder[0].vps >= 10 || (marketEmpty && previousMarketEmpty))) {
             table << "*** Entering era 2!\n";
             era = 2;
+            events.record(cursor,NO_PLAYER,EVENT_ERA,0,0,era);
         }
         else if (era == 2 && (playerOrder[0].vps >= minVpsForEra3[players.size()] || (marketEmpty && previousMarketEmpty))) {
             table << "*** Entering era 3!\n";
             era = 3;
+            events.record(cursor,NO_PLAYER,EVENT_ERA,0,0,era);
         }
         previousMarketEmpty = marketEmpty;
         
@@ -976,17 +1742,18 @@ public:
             if (!anyValid)
                 break;
             
-            int roll = (firstMarket + (rand() % marketSize));
+            int roll = (firstMarket + rngs.market.below(marketSize));
             for(;;) {
                 if (upgradeDrawPiles[roll] && currentMarketCounts[roll] != marketLimit)
                     break;
                 else if (roll) // try next upgrade downward
                     --roll;
                 else    // pick a new roll if we hit the bottom of the list
-                    roll = (firstMarket + (rand() % marketSize));
+                    roll = (firstMarket + rngs.market.below(marketSize));
             }
             
             table << upgradeNames[roll] << " added to market (" << upgradeHelp[roll] << ").\n";
+            events.record(cursor,NO_PLAYER,EVENT_MARKET,roll,0,0);
             upgradeDrawPiles[roll]--;
             currentMarketCounts[roll]++;
             upgradeMarket.push_back((upgradeEnum_t)roll);
@@ -1005,7 +1772,7 @@ public:
 
     void drawProductionCards() {
         for (playerOrderIt_t i=playerOrder.begin(); i!=playerOrder.end(); i++) {
-            players[i->selfIndex].drawProductionCards(bank,false);
+            players[i->selfIndex].drawProductionCards(bank,rngs.decks,false);
         }
     }
 
@@ -1015,20 +1782,9 @@ public:
         }
     }
 
-    void auctionUpgradeCards(playerIndex_t selfIndex) {
-        cardIndex_t nextAuction;
-        money_t bid;
-        displayPlayerOrder();
-        if (upgradeMarket.size() == 1)
-            table << "There is 1 card available for auction:";
-        else
-            table << "There are " << upgradeMarket.size() << " cards available for auction:";
-        for (int i=0; i<upgradeMarket.size(); i++)
-            table << " " << upgradeNames[upgradeMarket[i]];
-        table << "\n";
-        
-        // Notify everybody that an auction is starting, letting them know whether they
-        // already had their turn or it IS their turn or they haven't had their turn yet.
+    // Notify everybody that an auction is starting, letting them know whether they
+    // already had their turn or it IS their turn or they haven't had their turn yet.
+    void announceAuctions(playerIndex_t selfIndex) {
         turnphase_t phase = AUCTION_AFTER_MY_TURN;
         for (playerOrderIt_t i=playerOrder.begin(); i!=playerOrder.end(); i++) {
             if (selfIndex == i->selfIndex) {
@@ -1038,59 +1794,119 @@ public:
             else
                 players[i->selfIndex].brain->plan(phase);
         }
+    }
+
+    void auctionUpgradeCards(playerIndex_t selfIndex) {
+        if (cursor.stage == TURN_STARTING) {
+            displayPlayerOrder();
+            if (upgradeMarket.size() == 1)
+                table << "There is 1 card available for auction:";
+            else
+                table << "There are " << upgradeMarket.size() << " cards available for auction:";
+            for (cardIndex_t i=0; i<upgradeMarket.size(); i++)
+                table << " " << upgradeNames[upgradeMarket[i]];
+            table << "\n";
+            announceAuctions(selfIndex);
+            cursor.stage = TURN_AUCTIONS;
+        }
         
-        while (upgradeMarket.size() && (nextAuction = players[selfIndex].pickCardToAuction(upgradeMarket,bid)) != upgradeMarket.size()) {
-            // remove the card from the market
-            upgradeEnum_t upgrade = upgradeMarket[nextAuction];
-            upgradeMarket.erase(upgradeMarket.begin() + nextAuction);
-            currentMarketCounts[upgrade]--;
-            table << players[selfIndex].getName() << " places " << upgradeNames[upgrade] << " up for auction with an opening bid of " << bid << ".\n";
-            
-            // run the auction until everybody else passes.
-            unsigned numPassedInARow = 0;
-            playerIndex_t highBidder = selfIndex;
-            playerIndex_t nextBidder = selfIndex;
-            for (;;) {
-                if (++nextBidder == players.size())
-                    nextBidder = 0;
-                money_t newBid = players[nextBidder].raiseOrPass(players[highBidder],upgrade,bid+1);
-                // somebody wants to bid?
-                if (newBid) {
-                    highBidder = nextBidder;
-                    bid = newBid;
-                    numPassedInARow = 0;
-                    table << players[highBidder].getName() << " raises the bid to " << bid << ".\n";
-                }
-                // everybody else has passed?
-                else {
-                    table << players[nextBidder].getName() << " passes.\n";
-                    if (++numPassedInARow == players.size()-1)
-                        break;
-                }
+        for (;;) {
+            if (cursor.stage == TURN_AUCTIONS) {
+                cardIndex_t nextAuction;
+                money_t bid;
+                if (!upgradeMarket.size() || (nextAuction = players[selfIndex].pickCardToAuction(upgradeMarket,bid)) == upgradeMarket.size())
+                    break;
+                // remove the card from the market
+                upgradeEnum_t upgrade = upgradeMarket[nextAuction];
+                upgradeMarket.erase(upgradeMarket.begin() + nextAuction);
+                currentMarketCounts[upgrade]--;
+                table << players[selfIndex].getName() << " places " << upgradeNames[upgrade] << " up for auction with an opening bid of " << bid << ".\n";
+                events.record(cursor,selfIndex,EVENT_AUCTION,upgrade,0,bid);
+                cursor.stage = TURN_BIDDING;
+                cursor.upgrade = upgrade;
+                cursor.bid = bid;
+                cursor.highBidder = byte_t(selfIndex);
+                cursor.bidder = byte_t(selfIndex + 1 == players.size()? 0 : selfIndex + 1);
+                cursor.passesInARow = 0;
             }
-            
-            table << players[highBidder].getName() << " wins the auction for " << upgradeNames[upgrade] << " with " << bid << " credits.\n";
-            money_t discount = players[highBidder].computeDiscount(upgrade);
-            if (bid > discount)
-                players[highBidder].payFor(bid - discount,bank,0);
-            players[highBidder].addUpgrade(upgrade);
-            players[highBidder].computeExpectedIncome();
-            
-            displayPlayerOrder();
+            runAuction();
         }
-    }
-
-    const vector<player_t>& getPlayers() const {
-        return players;
+        cursor.stage = TURN_FACTORIES;
     }
     
-    void performPlayerTurns(bool firstTurn) {
-        for (playerOrderIt_t i=playerOrder.begin(); i!=playerOrder.end(); i++) {
-            table << "\n=== " << players[i->selfIndex].getName() << "'s turn ===\n\n";
-            auctionUpgradeCards(i->selfIndex);
-            players[i->selfIndex].purchaseFactories(firstTurn,bank);
-            players[i->selfIndex].purchaseAndAssignPersonnel(bank);
-        }        
+    // run the auction in the cursor until everybody else passes.
+    void runAuction() {
+        upgradeEnum_t upgrade = upgradeEnum_t(cursor.upgrade);
+        for (;;) {
+            money_t newBid = players[cursor.bidder].raiseOrPass(players[cursor.highBidder],upgrade,cursor.bid+1);
+            // somebody wants to bid?
+            if (newBid) {
+                cursor.highBidder = cursor.bidder;
+                cursor.bid = newBid;
+                cursor.passesInARow = 0;
+                table << players[cursor.highBidder].getName() << " raises the bid to " << cursor.bid << ".\n";
+                events.record(cursor,cursor.highBidder,EVENT_BID,upgrade,0,cursor.bid);
+            }
+            // everybody else has passed?
+            else {
+                table << players[cursor.bidder].getName() << " passes.\n";
+                events.record(cursor,cursor.bidder,EVENT_PASS,upgrade,0,0);
+                if (++cursor.passesInARow == players.size()-1)
+                    break;
+            }
+            if (++cursor.bidder == players.size())
+                cursor.bidder = 0;
+        }
+        
+        player_t &winner = players[cursor.highBidder];
+        table << winner.getName() << " wins the auction for " << upgradeNames[upgrade] << " with " << cursor.bid << " credits.\n";
+        events.record(cursor,cursor.highBidder,EVENT_UPGRADE,upgrade,0,cursor.bid);
+        money_t discount = winner.computeDiscount(upgrade);
+        if (cursor.bid > discount)
+            winner.payFor(cursor.bid - discount,bank,0);
+        winner.addUpgrade(upgrade);
+        winner.computeExpectedIncome();
+        cursor.stage = TURN_AUCTIONS;
+        
+        displayPlayerOrder();
+    }
+
+    const vector<player_t>& getPlayers() const {
+        return players;
+    }
+    
+    // Runs the turn of the player at cursor.turn, or the rest of it if it's already under way.
+    void performPlayerTurn(bool firstTurn) {
+        playerIndex_t selfIndex = playerOrder[cursor.turn].selfIndex;
+        player_t &self = players[selfIndex];
+        if (cursor.stage == TURN_STARTING)
+            table << "\n=== " << self.getName() << "'s turn ===\n\n";
+        if (cursor.stage <= TURN_BIDDING)
+            auctionUpgradeCards(selfIndex);
+        if (cursor.stage == TURN_FACTORIES) {
+            self.purchaseFactories(firstTurn,bank);
+            cursor.stage = TURN_COLONISTS;
+        }
+        if (cursor.stage == TURN_COLONISTS) {
+            self.purchaseColonists(bank);
+            cursor.stage = TURN_ROBOTS;
+        }
+        if (cursor.stage == TURN_ROBOTS) {
+            self.purchaseRobots(bank);
+            cursor.stage = TURN_PERSONNEL;
+        }
+        self.assignPersonnel();
+    }
+    
+    void finishPlayerTurns(bool firstTurn) {
+        for (; cursor.turn<playerOrder.size(); cursor.turn++, cursor.stage=TURN_STARTING)
+            performPlayerTurn(firstTurn);
+    }
+    
+    void performPlayerTurns(bool firstTurn) {
+        cursor.turn = 0;
+        cursor.stage = TURN_STARTING;
+        finishPlayerTurns(firstTurn);
     }
 
     bool checkVictoryConditions() {
@@ -1100,39 +1916,398 @@ public:
         
         table << "\n\n=== GAME OVER ===\n\nFinal rankings:\n";
         displayPlayerOrder();
+        for (playerIndex_t i=0; i<playerOrder.size(); i++)
+            events.record(cursor,playerOrder[i].selfIndex,EVENT_RANK,i,0,playerOrder[i].vps);
         return true;
     }
+
+    // Plays an entire game once all brains are attached.  Returns the number of rounds played,
+    // or zero if maxRounds (when nonzero) went by without anybody winning.
+    amt_t play(amt_t maxRounds = 0) {
+        // set up the play area, deal hands, etc
+        cursor.round = 1;
+        setupGame();
+        // do the first turn of the game (several phases are skipped)
+        displayPlayerOrder();
+        performPlayerTurns(true);
+        return playRemainingRounds(maxRounds);
+    }
+    
+    // Picks up a game restored from a snapshot taken during somebody's turn and plays on, same as play().
+    amt_t resume(amt_t maxRounds = 0) {
+        // brains restored along with a snapshot haven't heard about the auctions yet.
+        if (cursor.stage == TURN_AUCTIONS || cursor.stage == TURN_BIDDING)
+            announceAuctions(playerOrder[cursor.turn].selfIndex);
+        finishPlayerTurns(cursor.round == 1);
+        return playRemainingRounds(maxRounds);
+    }
+    
+    amt_t playRemainingRounds(amt_t maxRounds) {
+        // (after the first turn the game cannot possibly end, but this gets vp's and turn order correct for the second)
+        while (!checkVictoryConditions()) {
+            if (cursor.round == maxRounds)
+                return 0;
+            ++cursor.round;
+            table << "\n\n";
+            table << "        =======================\n";
+            table << "        ===  R O U N D  " << ((cursor.round<10)?" ":"") << cursor.round << "  ===\n";
+            table << "        =======================\n\n";
+            displayPlayerOrder();
+            replaceUpgradeCards();
+            drawProductionCards();
+            discardExcessProductionCards();
+            performPlayerTurns(false);
+        }
+        return cursor.round;
+    }
+
+    // The market refill and the first player's auctions from the start of a round, on their own.  For benchmarks.
+    void runOpeningAuctions() {
+        replaceUpgradeCards();
+        cursor.turn = 0;
+        cursor.stage = TURN_STARTING;
+        auctionUpgradeCards(playerOrder[0].selfIndex);
+    }
+
+    // Everything about the game, including what the players keep to themselves.
+    void displayState() {
+        table << "Round " << cursor.round << ", era " << int(era) << ".\n";
+        displayPlayerOrder();
+        for (playerIndex_t i=0; i<players.size(); i++) {
+            table << players[i].getName() << " holds";
+            for (size_t s=0; s<HAND_SLOTS; s++)
+                for (amt_t n=players[i].hand.getCount(s); n; n--)
+                    table << " " << factoryNames[hand_t::slotCard(s).prodType] << "/" << int(hand_t::slotCard(s).value);
+            table << ".\n";
+        }
+        table << "Market:";
+        for (size_t i=0; i<upgradeMarket.size(); i++)
+            table << " " << upgradeNames[upgradeMarket[i]];
+        table << "\n";
+        for (int i=ORE; i<PRODUCTION_COUNT; i++)
+            bank[i].dump();
+    }
+
+    // Standings as of the last victory point check; rank 0 is the leader (or winner).
+    playerIndex_t getPlayerAtRank(size_t rank) const { return playerOrder[rank].selfIndex; }
+    unsigned getVictoryPointsAtRank(size_t rank) const { return playerOrder[rank].vps; }
 };
 
-void brain_t::assignPersonnel() {
-    amt_t robotLimit = player->getRobotLimit();
+/*
+    Checkpoints.  A game in progress, saved whole.  gameState_t already holds everything about a game (the
+    decks and discards, the market and upgrade piles, the players, turn order, the random streams, and
+    where in the turn it is) as plain data, so a checkpoint is a gameState_t and a little about who sits
+    where, written exactly as it is in memory.  Reading one back is a single read into place: a file of
+    them is an array of checkpoint_t, which can as well be mapped.  Since nothing is converted, a checkpoint
+    only means something to a build that lays gameState_t out the same way; each one says how big its state
+    is and which byte order it was written in, and anything that doesn't match is refused rather than
+    misread.  Bump VERSION whenever a field of gameState_t changes meaning.
     
-    // everybody outta the pool!
-    for (int i=ORE; i<PRODUCTION_COUNT; i++) {
-        player->mannedByColonists[UNUSED] += player->mannedByColonists[i];
-        player->mannedByColonists[i] = 0;
-        player->mannedByRobots[UNUSED] += player->mannedByRobots[i];
-        player->mannedByRobots[i] = 0;
+    Take a checkpoint while a brain is being asked something (see gameCursor_t), then restoreState it into
+    a game_t with the same number of players and resume.  Brains keep nothing of their own in it: computer
+    players come back with the default personality, and whoever was being asked is asked again.
+*/
+
+struct checkpoint_t {
+    static const uint16_t VERSION = 1;
+    static const uint16_t BYTE_ORDER_MARK = 0x0102;
+    static const size_t NAME_LENGTH = 32;
+    
+    char magic[4];              // "OPCK"
+    uint16_t version, byteOrder;
+    uint32_t stateSize;         // sizeof(gameState_t)
+    uint16_t humans;            // a bit for each seat played by a person
+    uint16_t reserved;
+    char names[MAX_PLAYERS][NAME_LENGTH];   // nul terminated, and cut short if need be
+    gameState_t state;
+    
+    void save(const game_t &game,uint16_t humanSeats) {
+        // so that whatever padding there is doesn't end up in files.
+        memset((void*)this, 0, sizeof(*this));
+        memcpy(magic, "OPCK", 4);
+        version = VERSION;
+        byteOrder = BYTE_ORDER_MARK;
+        stateSize = sizeof(gameState_t);
+        humans = humanSeats;
+        for (playerIndex_t i=0; i<game.getPlayers().size(); i++)
+            strncpy(names[i], game.getPlayers()[i].getName().c_str(), NAME_LENGTH - 1);
+        game.saveState(state);
+    }
+    
+    // Whether this build can read it, and whether the state is sound enough to restore without tripping over
+    // anything: whatever is used to index something is in range, and whatever is counted twice agrees with itself.
+    bool isValid() const {
+        if (memcmp(magic, "OPCK", 4) || version != VERSION || byteOrder != BYTE_ORDER_MARK || stateSize != sizeof(gameState_t))
+            return false;
+        const byte_t playerCount = state.playerCount;
+        if (playerCount < 2 || playerCount > MAX_PLAYERS || state.era < 1 || state.era > 3 || state.marketSize > playerCount || state.marketLimit != playerCount >> 1)
+            return false;
+        // checkpoints are only taken while somebody is being asked something, so it's always somebody's turn.
+        const gameCursor_t &cursor = state.cursor;
+        if (cursor.turn >= playerCount || cursor.stage > TURN_PERSONNEL || cursor.upgrade >= UPGRADE_COUNT || cursor.bidder >= playerCount || cursor.highBidder >= playerCount)
+            return false;
+        if (cursor.stage == TURN_BIDDING && (cursor.bidder == cursor.highBidder || cursor.passesInARow + 1 >= playerCount))
+            return false;
+        uint16_t seated = 0;
+        for (playerIndex_t i=0; i<playerCount; i++) {
+            if (state.playerOrder[i].selfIndex >= playerCount || (seated & 1 << state.playerOrder[i].selfIndex))
+                return false;
+            seated |= 1 << state.playerOrder[i].selfIndex;
+            if (!isValidPlayer(state.players[i]))
+                return false;
+        }
+        
+        // every real production card is in a draw pile, a discard pile or somebody's hand, exactly once.
+        size_t productionCards = 0;
+        for (int i=ORE; i<PRODUCTION_COUNT; i++) {
+            const deckSpec_t &spec = deckSpecs[i];
+            size_t pile = state.drawPileSizes[i] + state.discardPileSizes[i];
+            if (pile > MAX_DECK_CARDS || productionCards + pile > PRODUCTION_CARD_COUNT)
+                return false;
+            size_t found[MAX_DECK_VALUES] = {};
+            for (size_t c=productionCards; c<productionCards + pile; c++) {
+                size_t v = 0;
+                while (v < spec.count && spec.dist[v].value != state.productionCards[c])
+                    v++;
+                if (v == spec.count)
+                    return false;
+                found[v]++;
+            }
+            productionCards += pile;
+            for (size_t v=0; v<spec.count; v++) {
+                card_t c = { spec.dist[v].value, byte_t(i), spec.countsInHandSize, true };
+                for (playerIndex_t p=0; p<playerCount; p++)
+                    found[v] += state.players[p].hand.getCount(hand_t::slotOf(c));
+                if (found[v] != spec.dist[v].count)
+                    return false;
+            }
+        }
+        
+        // every upgrade is still to be drawn, in the market, up for auction or owned, and no more of them than were dealt.
+        upgradeArray_t inMarket;
+        inMarket.fill(0);
+        for (size_t i=0; i<state.marketSize; i++) {
+            if (state.upgradeMarket[i] >= UPGRADE_COUNT)
+                return false;
+            inMarket[state.upgradeMarket[i]]++;
+        }
+        for (int u=DATA_LIBRARY; u<UPGRADE_COUNT; u++) {
+            if (state.currentMarketCounts[u] != inMarket[u] || inMarket[u] > state.marketLimit)
+                return false;
+            size_t dealt = state.upgradeDrawPiles[u] + inMarket[u] + (cursor.stage == TURN_BIDDING && cursor.upgrade == u);
+            for (playerIndex_t p=0; p<playerCount; p++)
+                dealt += state.players[p].upgrades[u];
+            if (dealt > game_t::getUpgradesDealt(playerCount,u))
+                return false;
+        }
+        return true;
+    }
+    
+    // The hand agrees with its own counts and what it's worth, everybody operating a factory has one to operate,
+    // and the VPs, limits and income are what the upgrades and factories make them.
+    static bool isValidPlayer(const playerState_t &p) {
+        size_t cards = 0, productionSize = 0;
+        money_t credits = 0;
+        uint16_t typeCounts[PRODUCTION_COUNT] = {};
+        for (size_t s=0; s<HAND_SLOTS; s++) {
+            const card_t &c = hand_t::slotCard(s);
+            amt_t n = p.hand.getCount(s);
+            cards += n;
+            typeCounts[c.prodType] += n;
+            productionSize += n * c.handSize;
+            credits += money_t(n * c.value);
+        }
+        if (cards != p.hand.cardCount || memcmp(typeCounts, p.hand.typeCounts, sizeof(typeCounts)) || productionSize != p.productionSize || credits != p.totalCredits)
+            return false;
+        amt_t colonists = 0, robots = 0;
+        for (int i=ORE; i<=UNUSED; i++) {
+            if (i != UNUSED && p.mannedByColonists[i] + p.mannedByRobots[i] > p.factories[i])
+                return false;
+            colonists += p.mannedByColonists[i];
+            robots += p.mannedByRobots[i];
+        }
+        if (colonists != p.colonists || robots != p.robots || p.victoryPoints != p.computeVictoryPoints())
+            return false;
+        // what the upgrades bring with them is the same as buying them all again.
+        playerState_t bought = player_t();
+        for (int u=DATA_LIBRARY; u<UPGRADE_COUNT; u++)
+            for (amt_t n=0; n<p.upgrades[u]; n++)
+                bought.addUpgrade(upgradeEnum_t(u));
+        if (p.colonistLimit != bought.colonistLimit || p.extraColonistLimit != bought.extraColonistLimit || 
+            p.productionLimit != bought.productionLimit || p.totalUpgradeCosts != bought.totalUpgradeCosts)
+            return false;
+        // expected income is only brought up to date now and then, but it can't be more than every factory operated would bring in.
+        playerState_t most = p;
+        for (int i=ORE; i<PRODUCTION_COUNT; i++) {
+            most.mannedByColonists[i] = p.factories[i];
+            most.mannedByRobots[i] = 0;
+        }
+        most.productionLimit = 0xFF;
+        most.computeExpectedIncome();
+        return p.averageIncome >= 0 && p.averageIncome <= most.averageIncome && p.expectedProductionSize <= most.expectedProductionSize;
+    }
+    
+    string getName(playerIndex_t seat) const { return string(names[seat], strnlen(names[seat], NAME_LENGTH)); }
+};
+
+static_assert(is_trivially_copyable<checkpoint_t>::value, "checkpoints are written as they are");
+
+// (only hosted games are checkpointed so far.)
+#if OUTPOST_FIBERS
+// Writes checkpoints one after another, as they are in memory.
+static void saveCheckpoints(outputSink_t &sink,const checkpoint_t *checkpoints,size_t count) {
+    sink.write((const char*)checkpoints, count * sizeof(checkpoint_t));
+}
+
+// Reads a whole file of checkpoints in one go.  Fails, saying why, unless every one of them is valid.
+static bool loadCheckpoints(const char *name,vector<checkpoint_t> &checkpoints) {
+    FILE *f = fopen(name,"rb");
+    if (!f) {
+        printf("Can't read %s.\n", name);
+        return false;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    checkpoints.resize(size > 0? size / sizeof(checkpoint_t) : 0);
+    bool ok = size >= 0 && size % sizeof(checkpoint_t) == 0 &&
+        (checkpoints.empty() || fread(&checkpoints[0], sizeof(checkpoint_t), checkpoints.size(), f) == checkpoints.size());
+    fclose(f);
+    for (size_t i=0; ok && i<checkpoints.size(); i++)
+        ok = checkpoints[i].isValid();
+    if (!ok)
+        printf("%s isn't a checkpoint file this build can read.\n", name);
+    return ok;
+}
+#endif
+
+/*
+    Personnel assignment.
+    
+    Era 3 factories only take colonists, and beat any other factory on both VPs and income, so they are
+    filled first.  That leaves one pool of interchangeable operators (colonists up to the colonist limit,
+    and robots up to the robot limit) for the ordinary factories.  Each of those operated is worth its VPs
+    plus the average value of its card if the card survives the production limit, with a Mega counted for
+    every four cards of a deck that has them.  Cards that don't fit are thrown out cheapest deck first,
+    so filling the decks that count against the limit from the most valuable down, the cards kept only
+    depend on how many operators went before.  That makes a DP over the number of operators placed so far
+    exact.  Research cards don't count against the limit, so whoever is left over goes there.
+*/
+
+// How much a victory point is worth against a round's income when deciding who operates what.
+static const money_t STAFFING_VALUE_PER_VP = 15;
+
+static const amt_t MAX_STAFFED = 64;
+
+// Decides how many operators work at each ordinary factory; staff must hold PRODUCTION_COUNT entries.
+static void planStaffing(const factoryArray_t &factories,amt_t operators,amt_t slots,amt_t *staff) {
+    // the decks that count against the limit, most valuable first, and then the rest
+    productionEnum_t limited[PRODUCTION_COUNT], exempt[PRODUCTION_COUNT];
+    amt_t limitedCount = 0, exemptCount = 0, capacity = 0;
+    for (int i=NEW_CHEMICALS; i>=ORE; i--) {
+        staff[i] = 0;
+        if (!factories[i])
+            continue;
+        capacity += factories[i];
+        if (deckSpecs[i].countsInHandSize)
+            limited[limitedCount++] = productionEnum_t(i);
+        else
+            exempt[exemptCount++] = productionEnum_t(i);
     }
-    // assign to factories from the top down, favoring humans first
-    for (int i=MOON_ORE; i>=ORE; i--) {
-        while (player->mannedByColonists[i] < player->factories[i] && player->mannedByColonists[UNUSED]) {
-            player->mannedByColonists[i]++;
-            player->mannedByColonists[UNUSED]--;
+    for (int i=ORBITAL_MEDICINE; i<PRODUCTION_COUNT; i++)
+        staff[i] = 0;
+    if (operators > capacity)
+        operators = capacity;
+    if (operators > MAX_STAFFED)
+        operators = MAX_STAFFED;
+    
+    // best[c] is the most that c operators at the limited factories considered so far can be worth.
+    money_t best[MAX_STAFFED + 1], next[MAX_STAFFED + 1];
+    byte_t took[PRODUCTION_COUNT][MAX_STAFFED + 1];
+    best[0] = 0;
+    for (amt_t c=1; c<=operators; c++)
+        best[c] = -1;
+    for (amt_t k=0; k<limitedCount; k++) {
+        productionEnum_t which = limited[k];
+        for (amt_t c=0; c<=operators; c++)
+            next[c] = -1;
+        for (amt_t c=0; c<=operators; c++) {
+            if (best[c] < 0)
+                continue;
+            for (amt_t n=0; n<=factories[which] && c+n<=operators; n++) {
+                amt_t kept = c >= slots? 0 : min(n,slots - c);
+                money_t value = best[c] + n * STAFFING_VALUE_PER_VP * vpsForMannedFactory[which] + expectedCardValue(which,kept);
+                if (value > next[c+n]) {
+                    next[c+n] = value;
+                    took[k][c+n] = byte_t(n);
+                }
+            }
         }
+        copy(next, next + operators + 1, best);
     }
-    // fill in anything remaining with robots but only up to the limit
-    for (int i=ORBITAL_MEDICINE; i>=ORE && robotLimit; i--) {
-        while (robotLimit && (player->mannedByColonists[i] + player->mannedByRobots[i]) < player->factories[i] && player->mannedByRobots[UNUSED]) {
-            player->mannedByRobots[i]++;
-            player->mannedByRobots[UNUSED]--;
-            --robotLimit;
+    
+    // whoever isn't at a limited factory goes to the exempt ones, best first
+    for (amt_t k=1; k<exemptCount; k++)
+        for (amt_t j=k; j && vpsForMannedFactory[exempt[j]] * STAFFING_VALUE_PER_VP + deckSpecs[exempt[j]].average >
+                             vpsForMannedFactory[exempt[j-1]] * STAFFING_VALUE_PER_VP + deckSpecs[exempt[j-1]].average; j--)
+            swap(exempt[j], exempt[j-1]);
+    money_t bestTotal = -1;
+    amt_t bestLimited = 0;
+    for (amt_t c=0; c<=operators; c++) {
+        if (best[c] < 0)
+            continue;
+        money_t total = best[c];
+        amt_t left = operators - c;
+        for (amt_t k=0; k<exemptCount; k++) {
+            amt_t n = min<amt_t>(left,factories[exempt[k]]);
+            total += n * STAFFING_VALUE_PER_VP * vpsForMannedFactory[exempt[k]] + expectedCardValue(exempt[k],n);
+            left -= n;
+        }
+        if (total > bestTotal) {
+            bestTotal = total;
+            bestLimited = c;
         }
     }
+    
+    amt_t left = operators - bestLimited;
+    for (amt_t k=0; k<exemptCount; k++) {
+        staff[exempt[k]] = min<amt_t>(left,factories[exempt[k]]);
+        left -= staff[exempt[k]];
+    }
+    for (amt_t k=limitedCount, c=bestLimited; k--; ) {
+        staff[limited[k]] = took[k][c];
+        c -= took[k][c];
+    }
+}
+
+void brain_t::assignPersonnel() {
+    // everybody outta the pool!
+    for (int i=ORE; i<PRODUCTION_COUNT; i++) {
+        player->transferOperators(player->mannedByColonists,i,UNUSED,player->mannedByColonists[i]);
+        player->transferOperators(player->mannedByRobots,i,UNUSED,player->mannedByRobots[i]);
+    }
+    // era 3 factories first; the extra colonists they allow for can't work anywhere else.
+    amt_t slots = player->productionLimit;
+    for (int i=MOON_ORE; i>=ORBITAL_MEDICINE; i--) {
+        amt_t n = min<amt_t>(player->factories[i],player->mannedByColonists[UNUSED]);
+        player->transferOperators(player->mannedByColonists,UNUSED,i,n);
+        slots -= min(n,slots);
+    }
+    amt_t colonists = min<amt_t>(player->mannedByColonists[UNUSED],player->colonistLimit);
+    amt_t robots = min<amt_t>(player->mannedByRobots[UNUSED],player->getRobotLimit());
+    amt_t staff[PRODUCTION_COUNT];
+    planStaffing(player->factories,colonists + robots,slots,staff);
+    // favor humans first, from the top down, then fill in the rest with robots
+    for (int i=NEW_CHEMICALS; i>=ORE; i--) {
+        amt_t n = min(staff[i],colonists);
+        player->transferOperators(player->mannedByColonists,UNUSED,i,n);
+        player->transferOperators(player->mannedByRobots,UNUSED,i,staff[i] - n);
+        colonists -= n;
+    }
 }
 
-money_t brain_t::payFor(money_t cost,vector<card_t> &hand,bank_t &bank,amt_t minResearchCards) {
-    size_t best;
+money_t brain_t::payFor(money_t cost,hand_t &hand,bank_t &bank,amt_t minResearchCards) {
+    cardMask_t best;
 
     if (debugLevel > 0) {
         debug << name << " needs to pay at least " << cost << " (of " << player->getTotalCredits() << ") from:\n";
@@ -1140,7 +2315,7 @@ money_t brain_t::payFor(money_t cost,vector<card_t> &hand,bank_t &bank,amt_t min
     }
     
     money_t paid = findBestCards(cost,hand,minResearchCards,&best);
-    cardIndex_t base = 0;
+    cardIndex_t base = hand.maskBase();
     table << name << " needs to pay " << cost << " and discards:";
     while (best) {
         if (best & 1) {
@@ -1155,39 +2330,68 @@ money_t brain_t::payFor(money_t cost,vector<card_t> &hand,bank_t &bank,amt_t min
     return paid;
 }
 
-money_t brain_t::findBestCards(money_t cost,vector<card_t> &hand,amt_t minResearchCards,size_t *bestOut) {
-    // i doubt a hand size of more than 31 cards is really possible.
-    // note this code could get pretty slow for bigger hands though since it's exhaustive.
-    size_t width = hand.size();
-    if (width > 25)
-        width = 25;     // keep this from taking a very long time
-    size_t handMax = 1U << width;
-    size_t bestCards = width;     // best cards is the entire hand.
-    size_t best = handMax - 1;    // best match is the entire hand.
-    amt_t bestValue = player->getTotalCredits();  // best value is the entire hand.
+money_t brain_t::findBestCards(money_t cost,hand_t &hand,amt_t minResearchCards,cardMask_t *bestOut) {
+    // This is a subset-sum search over the (small) card values rather than an exhaustive search
+    // over every subset of the hand, so it stays cheap no matter how many cards we're holding.
+    card_t cards[MAX_CARDS_IN_MASK];
+    size_t width = hand.copyTo(cards,hand.maskBase());
+    cardMask_t best = width < MAX_CARDS_IN_MASK? (cardMask_t(1) << width) - 1 : ~cardMask_t(0);   // best match is the entire hand.
+    money_t bestValue = player->getTotalCredits();  // best value is the entire hand.
+    if (hand.maskBase()) {
+        bestValue = 0;
+        for (size_t i=0; i<width; i++)
+            bestValue += cards[i].value;
+    }
+    // we want the most value per hand slot discarded; the entire hand is scored by its card count.
+    money_t bestScore = bestValue - money_t(width);
+    bool foundSubset = false;
     // don't waste time if it's an exact match
-    if (bestValue > cost) {
-        for (unsigned i=1; i<handMax; i++) {
-            unsigned test = i;
-            amt_t testValue = 0, testResearchCount = 0, testMinValue = 0;
-            size_t testCards = 0;
-            // determine the value of this permutation, and remember how many cards there were.
-            for (unsigned j=0; j<width; j++,test>>=1) {
-                if (test & 1) {
-                    if (!testMinValue)
-                        testMinValue = hand[j].value;
-                    testValue += hand[j].value;
-                    testResearchCount += hand[j].prodType == RESEARCH;
-                    testCards += hand[j].handSize;
+    if (bestValue > cost && cost > 0) {
+        // sums[s * researchStates + r] is the best way to reach exactly s credits (always less than cost)
+        // using r research cards (capped at minResearchCards, which is all we care about).
+        size_t researchStates = minResearchCards + 1;
+        paymentState_t unreachable = { -1, 0 };
+        paymentScratch.assign(cost * researchStates, unreachable);
+        paymentState_t *sums = &paymentScratch[0];
+        sums[0].slots = 0;
+        
+        // The hand is kept sorted by value, so this visits the most valuable cards first.
+        // Before a card joins the table, try it as the cheapest card of a payment made up of it plus
+        // more valuable cards.  The payment must cover the cost but fall short without that cheapest card
+        // (don't throw out cards just for the sake of tossing them).
+        for (size_t j=width; j--; ) {
+            const card_t &card = cards[j];
+            money_t value = card.value;
+            size_t research = card.prodType == RESEARCH;
+            for (money_t s=(cost > value? cost - value : 0); s<cost; s++) {
+                for (size_t r=(minResearchCards > research? minResearchCards - research : 0); r<researchStates; r++) {
+                    const paymentState_t &with = sums[s * researchStates + r];
+                    if (with.slots < 0)
+                        continue;
+                    money_t testValue = s + value;
+                    money_t testScore = testValue - (with.slots + card.handSize);
+                    // maximize the number of hand slots we'd be discarding; among equals, overpay the least.
+                    if (testScore < bestScore || (foundSubset && testScore == bestScore && testValue < bestValue)) {
+                        best = with.cards | (cardMask_t(1) << j);
+                        bestValue = testValue;
+                        bestScore = testScore;
+                        foundSubset = true;
+                    }
                 }
             }
-            // if this is better than our previous best guess, remember it.
-            // also attempt to maximize the number of cards we'd be discarding.
-            // but don't throw out cards just for the sake of tossing them
-            if (testValue >= cost && testValue - testCards < bestValue - bestCards && testValue - testMinValue < cost && testResearchCount >= minResearchCards) {
-                best = i;
-                bestValue = testValue;
-                bestCards = testCards;
+            // now add it to the table; walk downward so the card is only used once.
+            for (money_t s=cost-1-value; s>=0; s--) {
+                for (size_t r=0; r<researchStates; r++) {
+                    const paymentState_t &without = sums[s * researchStates + r];
+                    if (without.slots < 0)
+                        continue;
+                    size_t withResearch = r + research < researchStates? r + research : researchStates - 1;
+                    paymentState_t &with = sums[(s + value) * researchStates + withResearch];
+                    if (without.slots + card.handSize > with.slots) {
+                        with.slots = without.slots + card.handSize;
+                        with.cards = without.cards | (cardMask_t(1) << j);
+                    }
+                }
             }
         }
     }
@@ -1201,28 +2405,24 @@ void brain_t::moveOperatorToNewFactory(productionEnum_t dest) {
     // always choose an unused colonist first
     if (player->mannedByColonists[UNUSED]) {
         table << name << " moves an unused colonist to operate the new " << factoryNames[dest] << ".\n";
-        player->mannedByColonists[UNUSED]--;
-        player->mannedByColonists[dest]++;
+        player->transferOperators(player->mannedByColonists,UNUSED,dest,1);
     }
     // next choose an unused robot, but only if we're not at the limit yet and the robot can work there.
     else if (player->mannedByRobots[UNUSED] && player->getRobotsInUse() < player->getRobotLimit() && robotCanOperate) {
         table << name << " moves an unused robot to operate the new " << factoryNames[dest] << ".\n";
-        player->mannedByRobots[UNUSED]--;
-        player->mannedByRobots[dest]++;
+        player->transferOperators(player->mannedByRobots,UNUSED,dest,1);
     }
     else {
         // find the first available colonist or robot at any factory "worse" than this one
         for (int i=ORE; i<dest; i++) {
             if (player->mannedByColonists[i]) {
                 table << name << " moves a colonist from " << factoryNames[i] << " to operate the new " << factoryNames[dest] << ".\n";
-                player->mannedByColonists[i]--;
-                player->mannedByColonists[dest]++;
+                player->transferOperators(player->mannedByColonists,i,dest,1);
                 return;
             }
             else if (robotCanOperate && player->mannedByRobots[i]) {
                 table << name << " moves a robot from " << factoryNames[i] << " to operate the new " << factoryNames[dest] << ".\n";
-                player->mannedByRobots[i]--;
-                player->mannedByRobots[dest]++;
+                player->transferOperators(player->mannedByRobots,i,dest,1);
                 return;
             }
         }
@@ -1262,42 +2462,421 @@ void brain_t::moveOperatorToNewFactory(productionEnum_t dest) {
     - If you have 40$, buy Titanium + Operator
     - If you have 70$, buy New Chem + Operator
  */
+
+/*
+    Card counting.  Everybody can see what has been discarded since each deck was last shuffled, and what
+    they're holding themselves.  Any other card from a deck (in the draw pile or somebody else's hand) is
+    as likely to be one of those "unseen" cards as another, so k cards from a deck that somebody else is
+    holding, or that are about to be drawn, are k of the unseen cards picked at random.  The chances of
+    their adding up to each total are hypergeometric, and totals over several decks are convolutions of
+    those.  (Draws that will need the discards shuffled back in are treated like any others.)
+*/
+
+// The widest a card-counting distribution can get: every card of every deck, from the cheapest values to the
+// dearest.  (Cards beyond what a deck holds are proxies, which are worth a fixed amount.)
+static constexpr size_t totalSpread(size_t d = 0) {
+    return d < PRODUCTION_COUNT? deckSpread(deckSpecs[d]) + totalSpread(d+1) : 0;
+}
+
+// The chance of something being worth each amount of money.  The odds are kept inline, so working them
+// out (which the computer player does for every bid) never touches the heap.
+class moneyDistribution_t {
+    static const size_t MAX_ODDS = totalSpread() + 1;
+    money_t low;            // the least it can be
+    size_t count;
+    double odds[MAX_ODDS];  // odds[i] is the chance of it being exactly low + i
+public:
+    moneyDistribution_t(money_t certain = 0) : low(certain), count(1) { odds[0] = 1.0; }
+    
+    money_t getLow() const { return low; }
+    money_t getHigh() const { return low + money_t(count) - 1; }
+    
+    void add(money_t certain) { low += certain; }
+    
+    // becomes the distribution of the sum of this and an independent amount, which is least + j with
+    // chance theirOdds[j] * scale.  Done in place from the top down, so each entry is read before
+    // anything is added to it.
+    void add(money_t least,const double *theirOdds,size_t theirCount,double scale) {
+        size_t sumCount = count + theirCount - 1;
+        assert(sumCount <= MAX_ODDS);
+        fill(odds + count, odds + sumCount, 0.0);
+        for (size_t i=count; i--; ) {
+            double p = odds[i] * scale;
+            odds[i] = 0;
+            if (p)
+                for (size_t j=0; j<theirCount; j++)
+                    odds[i + j] += p * theirOdds[j];
+        }
+        low += least;
+        count = sumCount;
+    }
+    
+    double mean() const {
+        double result = 0;
+        for (size_t i=0; i<count; i++)
+            result += odds[i] * (low + money_t(i));
+        return result;
+    }
+    
+    // the least amount that it's at least q likely to be no more than.
+    money_t quantile(double q) const {
+        double total = 0;
+        for (size_t i=0; i<count; i++) {
+            total += odds[i];
+            if (total >= q - 1e-9)
+                return low + money_t(i);
+        }
+        return getHigh();
+    }
+};
+
+struct binomials_t {
+    double choose[MAX_DECK_CARDS + 1][MAX_DECK_CARDS + 1];
+    binomials_t() {
+        memset(choose, 0, sizeof(choose));
+        for (size_t n=0; n<=MAX_DECK_CARDS; n++) {
+            choose[n][0] = 1;
+            for (size_t k=1; k<=n; k++)
+                choose[n][k] = choose[n-1][k-1] + choose[n-1][k];
+        }
+    }
+};
+
+static const binomials_t binomials;
+
+// Cards of a deck the player can't account for: neither discarded nor in their own hand, as a count
+// for each value in the deck's spec.
+static void getUnseen(const productionDeck_t &deck,const hand_t &own,byte_t *unseen) {
+    const deckSpec_t &spec = deck.getSpec();
+    deck.getUndiscarded(unseen);
+    for (size_t i=0; i<spec.count; i++) {
+        card_t c = { spec.dist[i].value, byte_t(deck.getType()), byte_t(spec.countsInHandSize), 1 };
+        byte_t held = own.getCount(hand_t::slotOf(c));
+        unseen[i] = held < unseen[i]? unseen[i] - held : 0;
+    }
+}
+
+// The most entries drawValue's table needs: every number of cards from none to a whole deck, by what they add up to.
+static constexpr size_t drawTableSize(size_t d = 0) {
+    return d == PRODUCTION_COUNT? 0 :
+        (cardsIn(deckSpecs[d]) + 1) * (deckSpread(deckSpecs[d]) + 1) > drawTableSize(d+1)?
+        (cardsIn(deckSpecs[d]) + 1) * (deckSpread(deckSpecs[d]) + 1) : drawTableSize(d+1);
+}
+
+// Adds to result what k cards picked at random from the unseen cards of a deck add up to.
+static void addDrawValue(moneyDistribution_t &result,const deckSpec_t &spec,const byte_t *unseen,amt_t k) {
+    amt_t total = 0;
+    for (size_t i=0; i<spec.count; i++)
+        total += unseen[i];
+    // any more than that must have been proxy cards (which are only handed out when the deck is exhausted)
+    if (k > total) {
+        result.add(money_t((k - total) * spec.average));
+        k = total;
+    }
+    byte_t least = spec.dist[0].value;
+    size_t width = k * (spec.dist[spec.count - 1].value - least) + 1;
+    // ways[j * width + s] is how many ways there are to pick j cards of the values so far adding up to j * least + s.
+    // Picking more of a value only ever adds to rows with more cards, so each value is folded in from the
+    // most cards down, in place.  One table per thread is plenty, since this never waits on anything.
+    static thread_local double ways[drawTableSize()];
+    fill(ways, ways + (k + 1) * width, 0.0);
+    ways[0] = 1;
+    for (size_t v=0; v<spec.count; v++) {
+        amt_t n = unseen[v];
+        if (!n)
+            continue;
+        size_t extra = spec.dist[v].value - least;
+        for (amt_t j=k+1; j--; )
+            for (size_t s=0; s<width; s++) {
+                double w = ways[j * width + s];
+                if (!w)
+                    continue;
+                for (amt_t m=1; m<=n && j+m<=k; m++)
+                    ways[(j + m) * width + s + m * extra] += w * binomials.choose[n][m];
+            }
+    }
+    result.add(money_t(k * least), ways + k * width, width, 1 / binomials.choose[total][k]);
+}
+
+// What the holder's hand is worth as far as the observer can tell.
+static moneyDistribution_t handValue(const bank_t &bank,const player_t &observer,const player_t &holder) {
+    // (only ever one distribution is returned, so it isn't copied.)
+    moneyDistribution_t result;
+    if (&observer == &holder) {
+        result.add(holder.getTotalCredits());
+        return result;
+    }
+    amt_t hidden[PRODUCTION_COUNT] = { 0 };
+    money_t known = 0;
+    for (size_t s=0; s<HAND_SLOTS; s++) {
+        const card_t &c = hand_t::slotCard(s);
+        // proxy and Mega cards are face up
+        if (c.returnToDiscard)
+            hidden[c.prodType] += holder.hand.getCount(s);
+        else
+            known += holder.hand.getCount(s) * c.value;
+    }
+    result.add(known);
+    for (int i=ORE; i<PRODUCTION_COUNT; i++)
+        if (hidden[i]) {
+            byte_t unseen[MAX_DECK_VALUES];
+            getUnseen(bank[i],observer.hand,unseen);
+            addDrawValue(result,bank[i].getSpec(),unseen,hidden[i]);
+        }
+    return result;
+}
+
+// What the producer's next production will be worth as far as the observer can tell, taking no Megas
+// and before anything is thrown out for the production limit.
+static moneyDistribution_t incomeValue(const bank_t &bank,const player_t &observer,const player_t &producer) {
+    moneyDistribution_t result;
+    for (int i=ORE; i<PRODUCTION_COUNT; i++) {
+        amt_t draws = producer.mannedByColonists[i] + producer.mannedByRobots[i];
+        if (i==RESEARCH)
+            draws += producer.upgrades[SCIENTISTS];
+        else if (i==MICROBIOTICS)
+            draws += producer.upgrades[ORBITAL_LAB];
+        if (draws) {
+            byte_t unseen[MAX_DECK_VALUES];
+            getUnseen(bank[i],observer.hand,unseen);
+            addDrawValue(result,bank[i].getSpec(),unseen,draws);
+        }
+    }
+    return result;
+}
+
+/*
+    Computer brain personalities.  Everything the computer brain weighs its decisions by is kept here rather
+    than written into the code, so that different sets can be played against each other (see --personality)
+    without rebuilding.  A personality file has one "name value" line per setting it changes; anything it
+    doesn't mention keeps the default, and # starts a comment.
+*/
+struct personality_t {
+    int markup;                     // in sixteenths: any upgrade is worth 20/16 = 125% of face value for starters
+    int dataLibraryAffinity;        // added per Data Library owned to Scientists and Laboratory (which it discounts)
+    int heavyEquipmentAffinity;     // and per Heavy Equipment to Warehouse and Nodule
+    // for Nodule, Robotics and Outpost with a colonist limit of 5 or 8; "Last" when its draw pile is empty
+    int noduleAt5, noduleAt5Last, roboticsAt5, roboticsAt5Last, outpostAt5, outpostAt5Last;
+    int noduleAt8, noduleAt8Last, roboticsAt8, roboticsAt8Last, outpostAt8, outpostAt8Last;
+    int roboticsForColonists;       // with fewer than two Nodules and Outposts between them
+    int scientistsWhenStuck, orbitalLabWhenStuck;     // at the colonist limit without Robotics
+    int ecoplantsForColonists;      // with room for more colonists
+    int noduleForCapacity, roboticsForCapacity, outpostForCapacity;   // when short of operators
+    int spaceStationPrice, planetaryCruiserPrice, moonBasePrice;
+    int lowIncome;                  // at or below this much average income we really need a factory
+    int incomeLag;                  // in sixteenths: or if the leader's income is more than this times ours
+    int vpSwing;                    // credits per victory point the high bidder would gain on us
+    int outbidPercent;              // how likely an opponent must be to have enough to count as able to outbid us
+    int megaPercent;                // how likely four cards must be to be worth less than a Mega to take the Mega
+};
+
+static constexpr personality_t defaultPersonality = {
+    20, 7, 3,
+    3, 8, 10, 20, 5, 12,
+    2, 6, 7, 13, 3, 10,
+    10, 15, 20, 15,
+    10, 30, 20,
+    200, 300, 400,
+    20, 20, 1, 10, 50
+};
+
+struct personalityParam_t {
+    const char *name;
+    int personality_t::*value;
+    int low, high;                  // the range --tune searches
+};
+
+static const personalityParam_t personalityParams[] = {
+    { "markup", &personality_t::markup, 0, 64 },
+    { "dataLibraryAffinity", &personality_t::dataLibraryAffinity, 0, 50 },
+    { "heavyEquipmentAffinity", &personality_t::heavyEquipmentAffinity, 0, 50 },
+    { "noduleAt5", &personality_t::noduleAt5, 0, 100 },
+    { "noduleAt5Last", &personality_t::noduleAt5Last, 0, 100 },
+    { "roboticsAt5", &personality_t::roboticsAt5, 0, 100 },
+    { "roboticsAt5Last", &personality_t::roboticsAt5Last, 0, 100 },
+    { "outpostAt5", &personality_t::outpostAt5, 0, 100 },
+    { "outpostAt5Last", &personality_t::outpostAt5Last, 0, 100 },
+    { "noduleAt8", &personality_t::noduleAt8, 0, 100 },
+    { "noduleAt8Last", &personality_t::noduleAt8Last, 0, 100 },
+    { "roboticsAt8", &personality_t::roboticsAt8, 0, 100 },
+    { "roboticsAt8Last", &personality_t::roboticsAt8Last, 0, 100 },
+    { "outpostAt8", &personality_t::outpostAt8, 0, 100 },
+    { "outpostAt8Last", &personality_t::outpostAt8Last, 0, 100 },
+    { "roboticsForColonists", &personality_t::roboticsForColonists, 0, 100 },
+    { "scientistsWhenStuck", &personality_t::scientistsWhenStuck, 0, 100 },
+    { "orbitalLabWhenStuck", &personality_t::orbitalLabWhenStuck, 0, 100 },
+    { "ecoplantsForColonists", &personality_t::ecoplantsForColonists, 0, 100 },
+    { "noduleForCapacity", &personality_t::noduleForCapacity, 0, 100 },
+    { "roboticsForCapacity", &personality_t::roboticsForCapacity, 0, 100 },
+    { "outpostForCapacity", &personality_t::outpostForCapacity, 0, 100 },
+    { "spaceStationPrice", &personality_t::spaceStationPrice, 0, 1000 },
+    { "planetaryCruiserPrice", &personality_t::planetaryCruiserPrice, 0, 1000 },
+    { "moonBasePrice", &personality_t::moonBasePrice, 0, 1000 },
+    { "lowIncome", &personality_t::lowIncome, 0, 100 },
+    { "incomeLag", &personality_t::incomeLag, 16, 64 },
+    { "vpSwing", &personality_t::vpSwing, 0, 10 },
+    { "outbidPercent", &personality_t::outbidPercent, 1, 99 },
+    { "megaPercent", &personality_t::megaPercent, 1, 99 }
+};
+
+static_assert(sizeof(personality_t) == NELEM(personalityParams) * sizeof(int), "every personality setting needs a name");
+
+static void writePersonality(FILE *out,const personality_t &p) {
+    for (size_t i=0; i<NELEM(personalityParams); i++)
+        fprintf(out, "%s %d\n", personalityParams[i].name, p.*personalityParams[i].value);
+}
+
+// Reads settings over whatever is already in p.  Returns false (having said why) if the file can't be read or has a mistake in it.
+static bool readPersonality(const char *fileName,personality_t &p) {
+    FILE *in = fopen(fileName, "r");
+    if (!in) {
+        printf("Unable to open %s\n", fileName);
+        return false;
+    }
+    char line[256];
+    bool ok = true;
+    for (unsigned lineNumber=1; ok && fgets(line, sizeof(line), in); lineNumber++) {
+        if (char *comment = strchr(line, '#'))
+            *comment = 0;
+        char name[64];
+        int value;
+        int fields = sscanf(line, "%63s %d", name, &value);
+        if (fields <= 0)
+            continue;
+        size_t i = 0;
+        while (i < NELEM(personalityParams) && strcmp(personalityParams[i].name, name))
+            i++;
+        if (fields != 2 || i == NELEM(personalityParams)) {
+            printf("%s:%u: expected a setting name and a number\n", fileName, lineNumber);
+            ok = false;
+        }
+        // prices, bonuses and odds all end up in unsigned amounts, where a negative one would wrap around.
+        else if (value < 0) {
+            printf("%s:%u: %s can't be negative\n", fileName, lineNumber, name);
+            ok = false;
+        }
+        else
+            p.*personalityParams[i].value = value;
+    }
+    fclose(in);
+    return ok;
+}
+
+/*
+    What the computer brain will pay for each upgrade before it looks at its cash is a base price plus
+    bonuses that depend only on its personality and a handful of yes/no facts about its position, packed
+    into a key; so all of that is worked out up front, for the default personality at compile time,
+    leaving plan a table lookup and the per-copy bonuses for upgrades it gets a discount from.
+*/
+enum planKeyBits_t {
+    PLAN_COLONIST_BAND = 3,             // 0 for a colonist limit of 5, 1 for 8, 2 for anything else
+    PLAN_NO_NODULES = 4,                // the draw piles for Nodule, Robotics and Outpost are empty
+    PLAN_NO_ROBOTICS = 8,
+    PLAN_NO_OUTPOSTS = 16,
+    PLAN_FEW_COLONIST_UPGRADES = 32,    // fewer than two Nodules and Outposts between them
+    PLAN_COLONISTS_STUCK = 64,          // at the colonist limit, without Robotics
+    PLAN_COLONISTS_WANTED = 128,        // room for more colonists (or a colonist limit of 5)
+    PLAN_NEED_CAPACITY = 256,           // production is limited by operators
+    PLAN_KEYS = 512
+};
+
+static constexpr int planColonistBonus(size_t key,bool last,int at5,int at5Last,int at8,int at8Last) {
+    return (key & PLAN_COLONIST_BAND) == 0? (last? at5Last : at5) : (key & PLAN_COLONIST_BAND) == 1? (last? at8Last : at8) : 0;
+}
+
+static constexpr int planPrice(const personality_t &p,size_t key,size_t upgrade) {
+    // the exact limits for era 3 will depend on our relative standing to the current high bidder.
+    return upgrade == SPACE_STATION? p.spaceStationPrice : upgrade == PLANETARY_CRUISER? p.planetaryCruiserPrice : upgrade == MOON_BASE? p.moonBasePrice :
+        ((upgradeCosts[upgrade] * p.markup) >> 4) +
+        (upgrade == NODULE? planColonistBonus(key,key & PLAN_NO_NODULES,p.noduleAt5,p.noduleAt5Last,p.noduleAt8,p.noduleAt8Last) :
+         upgrade == ROBOTICS? planColonistBonus(key,key & PLAN_NO_ROBOTICS,p.roboticsAt5,p.roboticsAt5Last,p.roboticsAt8,p.roboticsAt8Last) :
+         upgrade == OUTPOST? planColonistBonus(key,key & PLAN_NO_OUTPOSTS,p.outpostAt5,p.outpostAt5Last,p.outpostAt8,p.outpostAt8Last) : 0) +
+        (upgrade == ROBOTICS && (key & PLAN_FEW_COLONIST_UPGRADES)? p.roboticsForColonists : 0) +
+        // favor factories that do not require population when stuck
+        ((key & PLAN_COLONISTS_STUCK)? (upgrade == SCIENTISTS? p.scientistsWhenStuck : upgrade == ORBITAL_LAB? p.orbitalLabWhenStuck : 0) : 0) +
+        // ecoplants is actually pretty cheap for the VP's if we'll be buying colonists
+        (upgrade == ECOPLANTS && (key & PLAN_COLONISTS_WANTED)? p.ecoplantsForColonists : 0) +
+        ((key & PLAN_NEED_CAPACITY)? (upgrade == NODULE? p.noduleForCapacity : upgrade == ROBOTICS? p.roboticsForCapacity : upgrade == OUTPOST? p.outpostForCapacity : 0) : 0);
+}
+
+template <size_t... indices> struct indexList_t { };
+template <size_t count,size_t... indices> struct makeIndexList_t: makeIndexList_t<count - 1,count - 1,indices...> { };
+template <size_t... indices> struct makeIndexList_t<0,indices...> { typedef indexList_t<indices...> type; };
+
+struct planPrices_t {
+    int price[UPGRADE_COUNT];
+};
+
+struct planTable_t {
+    planPrices_t prices[PLAN_KEYS];
+};
+
+template <size_t... upgrades> static constexpr planPrices_t makePlanPrices(const personality_t &p,size_t key,indexList_t<upgrades...>) {
+    return planPrices_t{ { planPrice(p,key,upgrades)... } };
+}
+
+template <size_t... keys> static constexpr planTable_t makePlanTable(const personality_t &p,indexList_t<keys...>) {
+    return planTable_t{ { makePlanPrices(p,keys,makeIndexList_t<UPGRADE_COUNT>::type())... } };
+}
+
+// A personality along with its plan prices.
+struct aiPersonality_t {
+    personality_t params;
+    planTable_t plan;
+};
+
+static constexpr aiPersonality_t defaultAi = { defaultPersonality, makePlanTable(defaultPersonality,makeIndexList_t<PLAN_KEYS>::type()) };
+
+static_assert(defaultAi.plan.prices[PLAN_NO_ROBOTICS | PLAN_FEW_COLONIST_UPGRADES].price[ROBOTICS] == 62 + 20 + 10, "plan prices aren't what plan expects");
+
+// Fills in the plan prices for a personality made at run time.
+static void setPersonality(aiPersonality_t &ai,const personality_t &params) {
+    ai.params = params;
+    for (size_t key=0; key<PLAN_KEYS; key++)
+        for (size_t i=0; i<UPGRADE_COUNT; i++)
+            ai.plan.prices[key].price[i] = planPrice(params,key,i);
+}
+
+// Every personality loaded, for as long as the program runs (a deque, so they stay put as more are added).
+static deque<aiPersonality_t> loadedPersonalities;
+
+// Loads a personality file over the defaults, or returns NULL (having said why).
+static const aiPersonality_t *loadPersonality(const char *fileName) {
+    personality_t params = defaultPersonality;
+    if (!readPersonality(fileName,params))
+        return NULL;
+    loadedPersonalities.push_back(aiPersonality_t());
+    setPersonality(loadedPersonalities.back(),params);
+    return &loadedPersonalities.back();
+}
+
 class computerBrain_t: public brain_t {
+protected:
     const game_t &game;
+    const aiPersonality_t &ai;
+    const personality_t &traits;
+private:
     fixedvector<amt_t, UPGRADE_COUNT> priceWillPay;
     productionEnum_t factoryWeWant;
     bool reallyNeedMoreOperatorCapacity;
 public:
-    computerBrain_t(string name,const game_t &theGame) : brain_t(name), game(theGame) { 
+    computerBrain_t(string name,const game_t &theGame,const aiPersonality_t &personality = defaultAi) : brain_t(name), game(theGame), ai(personality), traits(personality.params) { 
         factoryWeWant = PRODUCTION_COUNT;
         reallyNeedMoreOperatorCapacity = false;
     } 
     amt_t wantMega(productionEnum_t which,amt_t maxMega) { 
         const productionDeck_t &deck = game.getBank()[which];
-        size_t discardCount = deck.getDiscardSize();
-        // If fewer than 4 discards, take our changes with regular cards
-        if (discardCount < 4)
-            return 0;
-        amt_t discardSum = deck.getDiscardSum();
-        for (cardIt_t c=player->hand.begin(); c!=player->hand.end(); c++) {
-            // count any normal cards in hand as well
-            if (c->prodType == which && c->handSize==1 && c->returnToDiscard) {
-                ++discardCount;
-                discardSum += c->value;
-            }
-                
-        }
-        // only take a mega if it's less than 4x the average of all known already-discarded cards
+        // take Megas if four cards drawn instead are likely enough to be worth less (by default, more likely than not).
         // in other words, we're more likely to take a mega if a lot of high-value cards have
-        // already been discarded.
-        return ((discardSum * 4) / discardCount) > deck.getMegaValue();
+        // already been discarded (or are in our own hand).
+        byte_t unseen[MAX_DECK_VALUES];
+        getUnseen(deck,player->hand,unseen);
+        moneyDistribution_t draws;
+        addDrawValue(draws,deck.getSpec(),unseen,4);
+        return draws.quantile(traits.megaPercent / 100.0) < deck.getMegaValue()? 1 : 0;
     }
-    cardIndex_t pickDiscard(vector<card_t> &hand) {
-        // Hand is already in sorted order.  But *never* pick a "free" card to discard.
-        cardIndex_t i = 0;
-        while (hand[i].handSize == 0)
-            ++i;
-        return i;
+    cardIndex_t pickDiscard(hand_t &hand) {
+        return cheapestDiscard(hand);
     }
     void plan(turnphase_t phase) {
         /*
@@ -1328,56 +2907,33 @@ public:
         if (phase == BUYING_FACTORIES)
             assignPersonnel();
         
-        // any upgrade is 125% of face value for starters.
-        for (int i=0; i<UPGRADE_COUNT; i++)
-            priceWillPay[i] = (upgradeCosts[i] * 20) >> 4;
-        
-        // favor things we have discounts for (but not necessarily at full discount value)
-        priceWillPay[WAREHOUSE] += 3 * player->upgrades[HEAVY_EQUIPMENT];
-        priceWillPay[NODULE] += 3 * player->upgrades[HEAVY_EQUIPMENT];
-        priceWillPay[SCIENTISTS] += 7 * player->upgrades[DATA_LIBRARY];
-        priceWillPay[LABORATORY] += 7 * player->upgrades[DATA_LIBRARY];
-        if (player->colonistLimit == 5) {
-            priceWillPay[NODULE] += game.upgradeDrawPiles[NODULE]? 3 : 8;
-            priceWillPay[ROBOTICS] += game.upgradeDrawPiles[ROBOTICS]? 10 : 20;
-            priceWillPay[OUTPOST] += game.upgradeDrawPiles[OUTPOST]? 5 : 12;
-        }
-        else if (player->colonistLimit == 8) {
-            priceWillPay[NODULE] += game.upgradeDrawPiles[NODULE]? 2 : 6;
-            priceWillPay[ROBOTICS] += game.upgradeDrawPiles[ROBOTICS]? 7 : 13;
-            priceWillPay[OUTPOST] += game.upgradeDrawPiles[OUTPOST]? 3 : 10;
-        }
+        size_t key = (player->colonistLimit == 5? 0 : player->colonistLimit == 8? 1 : 2);
+        if (!game.upgradeDrawPiles[NODULE])
+            key |= PLAN_NO_NODULES;
+        if (!game.upgradeDrawPiles[ROBOTICS])
+            key |= PLAN_NO_ROBOTICS;
+        if (!game.upgradeDrawPiles[OUTPOST])
+            key |= PLAN_NO_OUTPOSTS;
         if (player->upgrades[NODULE] + player->upgrades[OUTPOST] < 2)
-            priceWillPay[ROBOTICS] += 10;
-        // If we're at our colonist limit and we don't have robotics, favor factories that
-        // do not require population
-        if (player->colonists >= player->colonistLimit && !player->upgrades[ROBOTICS]) {
-            priceWillPay[SCIENTISTS] += 15;
-            priceWillPay[ORBITAL_LAB] += 20;
-        }
-        // If we have room to buy more colonists, or we expect we'll be buying more,
-        // be willing to pay more for ecoplants (which actually is pretty cheap for the VP's)
+            key |= PLAN_FEW_COLONIST_UPGRADES;
+        if (player->colonists >= player->colonistLimit && !player->upgrades[ROBOTICS])
+            key |= PLAN_COLONISTS_STUCK;
         if (player->colonists < player->colonistLimit + player->extraColonistLimit || player->colonistLimit == 5)
-            priceWillPay[ECOPLANTS] += 15;
+            key |= PLAN_COLONISTS_WANTED;
         // If we're really short on operator capacity (ie it's limiting our production) raise our prices even higher
-        if (reallyNeedMoreOperatorCapacity) {
-            priceWillPay[NODULE] += 10;
-            priceWillPay[ROBOTICS] += 30;
-            priceWillPay[OUTPOST] += 20;
-        }
-        
-        // We'll pay up to $20/VP for any era 3 tech.  The exact limits will
-        // depend on our relative standing to the current high bidder.
-        priceWillPay[SPACE_STATION] = 200;
-        priceWillPay[PLANETARY_CRUISER] = 300;
-        priceWillPay[MOON_BASE] = 400;
+        if (reallyNeedMoreOperatorCapacity)
+            key |= PLAN_NEED_CAPACITY;
+        const planPrices_t &prices = ai.plan.prices[key];
+        for (int i=0; i<UPGRADE_COUNT; i++)
+            priceWillPay[i] = prices.price[i];
+        // favor things we have discounts for (but not necessarily at full discount value)
+        priceWillPay[WAREHOUSE] += traits.heavyEquipmentAffinity * player->upgrades[HEAVY_EQUIPMENT];
+        priceWillPay[NODULE] += traits.heavyEquipmentAffinity * player->upgrades[HEAVY_EQUIPMENT];
+        priceWillPay[SCIENTISTS] += traits.dataLibraryAffinity * player->upgrades[DATA_LIBRARY];
+        priceWillPay[LABORATORY] += traits.dataLibraryAffinity * player->upgrades[DATA_LIBRARY];
 
         // if new chemicals is possible, save up for that.
-        bool hasResearch = false;
-        for (cardIt_t c=player->hand.begin(); c!=player->hand.end(); c++)
-            if (c->prodType == RESEARCH)
-                hasResearch = true;
-        if (hasResearch)
+        if (player->hand.countOf(RESEARCH))
             factoryWeWant = NEW_CHEMICALS;
         else if (player->upgrades[SCIENTISTS])
             factoryWeWant = RESEARCH;
@@ -1416,14 +2972,14 @@ public:
         // If we want a factory and we're far enough behind on incomine and we haven't yet had our turn, 
         // make sure none of our bids will prevent us from also purchasing a factory.
         // (at beginning of game, we really want to get to three water factories)
-        bool reallyNeedFactory = player->getAverageIncome() <= 20;
+        bool reallyNeedFactory = player->getAverageIncome() <= traits.lowIncome;
         if (!reallyNeedFactory) {
             money_t bestIncome = game.players[0].getAverageIncome();
             for (int i=1; i<game.players.size(); i++)
                 if (bestIncome < game.players[i].getAverageIncome())
                     bestIncome = game.players[i].getAverageIncome();
-            // If we're more than 25% behind the income leader, we really want a factory.
-            if (((player->getAverageIncome() * 20) >> 4) < bestIncome)
+            // If we're more than 25% (by default) behind the income leader, we really want a factory.
+            if (((player->getAverageIncome() * traits.incomeLag) >> 4) < bestIncome)
                 reallyNeedFactory = true;
         }
         
@@ -1438,11 +2994,10 @@ public:
                 if (debugLevel > 0)
                     debug << name << " expects to have to discard " << expectedDiscards << " next turn, ";
                 money_t expectedWaste = 0;
-                static const byte_t averageIncome[] = { 3, 7, 10, 13, 17, 20 };
                 for (int i=ORE; expectedDiscards && i<=NEW_CHEMICALS; i++) {
                     int operators = player->mannedByColonists[i] + player->mannedByRobots[i];
                     while (expectedDiscards && operators) {
-                        expectedWaste += averageIncome[i];
+                        expectedWaste += deckSpecs[i].average;
                         --expectedDiscards;
                         --operators;
                     }
@@ -1482,10 +3037,11 @@ public:
                     }
                     debug << priceWillPay[i] << "$ for a " << upgradeNames[i] << "; ";
                 }
-            debug << " Total cash on hand: " << player->getTotalCredits() << ".\n";
+            moneyDistribution_t income = incomeValue(game.getBank(),*player,*player);
+            debug << " Total cash on hand: " << player->getTotalCredits() << "; next production probably " << income.quantile(0.1) << "-" << income.quantile(0.9) << "$.\n";
         }
      }
-    cardIndex_t pickCardToAuction(vector<card_t> &hand,vector<upgradeEnum_t> &upgradeMarket,money_t &bid) {
+    cardIndex_t pickCardToAuction(hand_t &hand,vector<upgradeEnum_t> &upgradeMarket,money_t &bid) {
         // figure out which things we can actually afford.
         amt_t bestWillPay = 0;
         cardIndex_t bestIndex = upgradeMarket.size();
@@ -1504,12 +3060,12 @@ public:
         bid = findBestCards(upgradeCosts[upgradeMarket[bestIndex]] - bestDiscount,hand,0,0) + bestDiscount;
         return bestIndex;
     }
-    money_t raiseOrPass(player_t &highBidder,vector<card_t> &hand,upgradeEnum_t upgrade,money_t minBid) {
+    money_t raiseOrPass(player_t &highBidder,hand_t &hand,upgradeEnum_t upgrade,money_t minBid) {
         // if we can't afford a higher bid, bail out now.
         if (player->getTotalCredits() < minBid)
             return 0;
         // Figure out how many victory points they would gain or lose on us if current high bidder won.
-        money_t vpDelta = highBidder.computeVictoryPoints() + potentialVpsForUpgrade[upgrade] - player->computeVictoryPoints();
+        money_t vpDelta = highBidder.getVictoryPoints() + potentialVpsForUpgrade[upgrade] - player->getVictoryPoints();
         if (debugLevel > 0)
             debug << name << " will pay up to " << priceWillPay[upgrade] << " for a " << upgradeNames[upgrade] << " and " << highBidder.getName() << " will be " << (vpDelta<0?-vpDelta:vpDelta) << " points " <<
             (vpDelta>0?"ahead":"behind") << " if they won.\n";
@@ -1517,8 +3073,8 @@ public:
         // But take the victory point swing if the current high bidder wins, relative to us, into account.
         // If they're going to be ahead of us, adjust our max price higher.  If they'll be behind us, don't care so much.
         // VP delta should be multiplied by a factor since a victory point typically "costs" about 15$, but we don't want
-        // that affecting our decision too much.  Could be a per-AI property.
-        if (priceWillPay[upgrade] < minBid - (vpDelta))
+        // that affecting our decision too much; it's the personality's vpSwing.
+        if (money_t(priceWillPay[upgrade]) < minBid - traits.vpSwing * vpDelta)
             return 0;
         
         amt_t discount = player->computeDiscount(upgrade);
@@ -1529,17 +3085,21 @@ public:
             // find the closest match
             money_t bid = findBestCards(minBid - discount,hand,0,0) + discount;
             
-            // based on number of cards in their hand and their discount, figure out
+            // based on what's probably in their hand and their discount, figure out
             // how many opponents might still be able to outbid us.
             amt_t playersWhoMightOutbidUs = 0;
             for (playerIndex_t i=0; i<game.getPlayers().size(); i++) {
                 const player_t &p = game.getPlayers()[i];
-                money_t mini, maxi;
-                if (&p != player) {
-                    p.getExpectedMoneyInHand(mini,maxi);
-                    if (maxi + p.computeDiscount(upgrade) > bid)
-                        ++playersWhoMightOutbidUs;
-                }
+                if (&p == player)
+                    continue;
+                // they might outbid us if they're likely enough to have enough (by default, 1 in 10);
+                // only work out the odds when their least and most possible don't already settle it.
+                money_t mini, maxi, discount = p.computeDiscount(upgrade);
+                p.getExpectedMoneyInHand(mini,maxi);
+                if (maxi + discount <= bid)
+                    continue;
+                if (mini + discount > bid || handValue(game.getBank(),*player,p).quantile(1 - traits.outbidPercent / 100.0) + discount > bid)
+                    ++playersWhoMightOutbidUs;
             }
             // If we're in a 3p game, and we can bid up to 10 and the current bid is 8, jump to high bid now
             // because otherwise the other two players might raise it back up.  In other words, if we're
@@ -1598,32 +3158,706 @@ public:
     }
 };
 
-class playerBrain_t: public brain_t {
-public:
-    playerBrain_t(string name) : brain_t(name) { }
-    amt_t wantMega(productionEnum_t t,amt_t maxMega) {
-        for (;;) {
-            active << name << ", how many megaproduction cards for " << factoryNames[t] << " do you want (empty for none, at most " << maxMega << ")? ";
-            amt_t answer = readUnsigned();
-            if (answer == EMPTY)
-                return 0;
-            else if (answer <= maxMega)
-                return answer;
-            else
-                active << "That is too many megaproduction cards.\n";
-        }
-    }
-   cardIndex_t pickDiscard(vector<card_t> &hand) {
-        active << name << ", you are over your hand limit.\n";
-        displayProductionCards(hand);
-        cardIndex_t which = 0;
-        do {
-            active << name << ", which card to you want to discard? ";
-            which = readUnsigned();
+// Decisions a search can be asked to make, and a particular answer to one.
+enum decisionEnum_t {
+    DECIDE_NOTHING,
+    DECIDE_AUCTION,         // which = market index (market size for none), amount = opening bid
+    DECIDE_BID,             // amount = bid, or zero to pass
+    DECIDE_FACTORIES,       // which = productionEnum_t, amount = how many (zero for none)
+    DECIDE_COLONISTS,       // amount = how many
+    DECIDE_ROBOTS,          // amount = how many
+    // the rest are never searched, only recorded (see decisionLog_t) and listed by legalActions
+    DECIDE_MEGA,            // amount = how many
+    DECIDE_DISCARD,         // which = hand slot (see hand_t::slotCard)
+    DECIDE_PAYMENT,         // which = hand slot of the next card to give up
+    DECIDE_PERSONNEL,       // one operator moved: which = from (plus PERSONNEL_ROBOT for a robot), amount = to;
+                            // a colonist from UNUSED to UNUSED is done moving people
+    DECIDE_OPERATOR,        // same, to the factory that came with an upgrade (or UNUSED to UNUSED for nobody)
+    DECIDE_COUNT
+};
+
+static const byte_t PERSONNEL_ROBOT = 0x80;
+
+static const char *decisionNames[DECIDE_COUNT] = { "nothing", "auction", "bid", "factories", "colonists", "robots",
+    "mega", "discard", "payment", "personnel", "operator" };
+
+struct action_t {
+    byte_t decision;        // decisionEnum_t
+    byte_t which;
+    money_t amount;
+    bool operator==(const action_t &that) const { return decision == that.decision && which == that.which && amount == that.amount; }
+};
+
+/*
+    Legal actions.  A game stopped at a decision is a gameState_t plus a decisionPoint_t saying who has to
+    decide what.  legalActions lists every answer the rules allow, and applyAction carries one out on the
+    state and says what has to be decided next.  Neither one narrates, logs or allocates, so search and
+    learning code can walk through a game with them at the cost of copying a state.
+    
+    They cover the players' turns: auctions and bids, buying factories, colonists and robots, and moving
+    personnel at the end of the turn.  Paying for anything is a decision of its own, made a card at a time,
+    as is who operates a factory that came with an upgrade.  What happens between rounds (refilling the
+    market, production) is random and stays with game_t: once every player has had their turn, nextDecision
+    says DECIDE_NOTHING, and a game_t restored from the state picks up from there (see game_t::resume).
+    The Megas and discards asked for during production are listed too, and discards can be applied, but
+    taking Megas doesn't change anything until the cards are drawn.
+*/
+
+// Who has to decide what, with what the brain_t call asking them is told.
+struct decisionPoint_t {
+    byte_t decision;        // decisionEnum_t
+    byte_t seat;
+    byte_t which;           // MEGA: the deck; BID: the upgrade; PAYMENT: the upgrade won (UPGRADE_COUNT for anything else);
+                            // OPERATOR: the new factory
+    amt_t limit;            // MEGA: the most there can be; PAYMENT: research cards still to be given up
+    money_t amount;         // BID: the least raise; PAYMENT: credits still owed
+};
+
+static void ask(decisionPoint_t &point,decisionEnum_t decision,playerIndex_t seat,size_t which = 0,amt_t limit = 0,money_t amount = 0) {
+    point.decision = byte_t(decision);
+    point.seat = byte_t(seat);
+    point.which = byte_t(which);
+    point.limit = limit;
+    point.amount = amount;
+}
+
+// Counts legal actions, keeping as many as the caller has room for.
+struct actionList_t {
+    action_t *out;
+    size_t capacity, count;
+    byte_t decision;
+    
+    void add(size_t which,money_t amount) {
+        if (count < capacity) {
+            action_t a = { decision, byte_t(which), amount };
+            out[count] = a;
+        }
+        count++;
+    }
+    void addTransfers(const playerState_t &p,int to) {
+        for (int robot=0; robot<2; robot++)
+            for (int from=ORE; from<=UNUSED; from++)
+                if (from != to && p.checkTransfer(robot != 0,from,to,1) == TRANSFER_OK)
+                    add(from | (robot? PERSONNEL_ROBOT : 0),to);
+    }
+};
+
+// Writes out as many of the legal answers to point as there's room for, and returns how many there are.
+static size_t legalActions(const gameState_t &state,const decisionPoint_t &point,action_t *out,size_t capacity) {
+    const playerState_t &p = state.players[point.seat];
+    actionList_t list = { out, capacity, 0, point.decision };
+    switch (point.decision) {
+        case DECIDE_MEGA:
+            for (amt_t n=0; n<=point.limit; n++)
+                list.add(point.which,n);
+            break;
+        case DECIDE_DISCARD:
+            for (size_t s=0; s<HAND_SLOTS; s++)
+                if (p.hand.getCount(s))
+                    list.add(s,0);
+            break;
+        case DECIDE_AUCTION:
+            list.add(state.marketSize,0);
+            for (size_t i=0; i<state.marketSize; i++) {
+                upgradeEnum_t upgrade = upgradeEnum_t(state.upgradeMarket[i]);
+                // the same upgrade twice in the market is the same choice
+                if (find(state.upgradeMarket, state.upgradeMarket + i, upgrade) != state.upgradeMarket + i)
+                    continue;
+                money_t most = p.totalCredits + p.computeDiscount(upgrade);
+                for (money_t bid=upgradeCosts[upgrade]; bid<=most; bid++)
+                    list.add(i,bid);
+            }
+            break;
+        case DECIDE_BID: {
+            list.add(point.which,0);
+            money_t most = p.totalCredits + p.computeDiscount(upgradeEnum_t(point.which));
+            for (money_t bid=point.amount; bid<=most; bid++)
+                list.add(point.which,bid);
+            break;
+        }
+        case DECIDE_FACTORIES: {
+            byte_t maxByType[PRODUCTION_COUNT];
+            p.getMaxFactories(maxByType);
+            if (p.canTradeInForWater(state.cursor.round == 1))
+                maxByType[WATER] = 1;
+            list.add(PRODUCTION_COUNT,0);
+            for (int i=ORE; i<=NEW_CHEMICALS; i++)
+                for (amt_t n=1; n<=maxByType[i]; n++)
+                    list.add(i,n);
+            break;
+        }
+        case DECIDE_COLONISTS:
+            for (amt_t n=0; n<=p.getMaxColonists(); n++)
+                list.add(0,n);
+            break;
+        case DECIDE_ROBOTS:
+            for (amt_t n=0; n<=p.getMaxRobots(); n++)
+                list.add(0,n);
+            break;
+        case DECIDE_PAYMENT:
+            // once the credits are covered, only the research cards still owed
+            for (size_t s=0; s<HAND_SLOTS; s++)
+                if (p.hand.getCount(s) && (point.amount > 0 || hand_t::slotCard(s).prodType == RESEARCH))
+                    list.add(s,0);
+            break;
+        case DECIDE_PERSONNEL:
+            list.add(UNUSED,UNUSED);
+            for (int to=ORE; to<=UNUSED; to++)
+                list.addTransfers(p,to);
+            break;
+        case DECIDE_OPERATOR:
+            list.add(UNUSED,UNUSED);
+            list.addTransfers(p,point.which);
+            break;
+    }
+    return list.count;
+}
+
+// Gives up a card from a hand to its deck's discards, in a state's copy of the decks.
+static void discardToState(gameState_t &state,const card_t &card) {
+    if (!card.returnToDiscard)      // mega cards (and virtual cards) don't go into same deck
+        return;
+    size_t at = 0, end = 0;
+    for (int i=ORE; i<PRODUCTION_COUNT; i++) {
+        end += state.drawPileSizes[i] + state.discardPileSizes[i];
+        if (i == card.prodType)
+            at = end;
+    }
+    assert(end < PRODUCTION_CARD_COUNT);
+    copy_backward(state.productionCards + at, state.productionCards + end, state.productionCards + end + 1);
+    state.productionCards[at] = card.value;
+    state.discardPileSizes[card.prodType]++;
+}
+
+// Moves the cursor past any step of the turn where there's nothing to decide, and describes the decision
+// it stops at: DECIDE_NOTHING once every player has had their turn this round.
+static void nextDecision(gameState_t &state,decisionPoint_t &point) {
+    gameCursor_t &cursor = state.cursor;
+    while (cursor.turn < state.playerCount) {
+        playerIndex_t seat = state.playerOrder[cursor.turn].selfIndex;
+        playerState_t &p = state.players[seat];
+        switch (cursor.stage) {
+            case TURN_STARTING:
+                cursor.stage = TURN_AUCTIONS;
+                break;
+            case TURN_AUCTIONS:
+                if (state.marketSize)
+                    return ask(point,DECIDE_AUCTION,seat);
+                cursor.stage = TURN_FACTORIES;
+                break;
+            case TURN_BIDDING:
+                return ask(point,DECIDE_BID,cursor.bidder,cursor.upgrade,0,cursor.bid + 1);
+            case TURN_FACTORIES: {
+                byte_t maxByType[PRODUCTION_COUNT];
+                p.getMaxFactories(maxByType);
+                if (maxByType[ORE] || p.canTradeInForWater(cursor.round == 1))
+                    return ask(point,DECIDE_FACTORIES,seat);
+                p.computeExpectedIncome();
+                cursor.stage = TURN_COLONISTS;
+                break;
+            }
+            case TURN_COLONISTS:
+                if (p.getMaxColonists())
+                    return ask(point,DECIDE_COLONISTS,seat);
+                cursor.stage = TURN_ROBOTS;
+                break;
+            case TURN_ROBOTS:
+                if (p.getMaxRobots())
+                    return ask(point,DECIDE_ROBOTS,seat);
+                cursor.stage = TURN_PERSONNEL;
+                break;
+            case TURN_PERSONNEL:
+                return ask(point,DECIDE_PERSONNEL,seat);
+        }
+    }
+    ask(point,DECIDE_NOTHING,0);
+}
+
+// The auction in the cursor is over and paid for.
+static void finishAuction(gameState_t &state,decisionPoint_t &point) {
+    playerState_t &winner = state.players[state.cursor.highBidder];
+    productionEnum_t newFactory = winner.addUpgrade(upgradeEnum_t(state.cursor.upgrade));
+    winner.computeExpectedIncome();
+    state.cursor.stage = TURN_AUCTIONS;
+    if (newFactory != PRODUCTION_COUNT)
+        ask(point,DECIDE_OPERATOR,state.cursor.highBidder,newFactory);
+    else
+        nextDecision(state,point);
+}
+
+// Carries out one of the answers legalActions lists for point, and leaves point describing the next decision.
+static void applyAction(gameState_t &state,decisionPoint_t &point,const action_t &a) {
+    gameCursor_t &cursor = state.cursor;
+    playerState_t &p = state.players[point.seat];
+    switch (point.decision) {
+        case DECIDE_MEGA:
+            ask(point,DECIDE_NOTHING,0);
+            return;
+        case DECIDE_DISCARD: {
+            card_t card = hand_t::slotCard(a.which);
+            p.removeCard(card);
+            discardToState(state,card);
+            if (p.productionSize <= p.productionLimit)
+                ask(point,DECIDE_NOTHING,0);
+            return;
+        }
+        case DECIDE_AUCTION:
+            if (a.which == state.marketSize) {
+                cursor.stage = TURN_FACTORIES;
+                break;
+            }
+            cursor.upgrade = state.upgradeMarket[a.which];
+            copy(state.upgradeMarket + a.which + 1, state.upgradeMarket + state.marketSize, state.upgradeMarket + a.which);
+            state.marketSize--;
+            state.currentMarketCounts[cursor.upgrade]--;
+            cursor.stage = TURN_BIDDING;
+            cursor.bid = a.amount;
+            cursor.highBidder = point.seat;
+            cursor.bidder = byte_t(point.seat + 1 == state.playerCount? 0 : point.seat + 1);
+            cursor.passesInARow = 0;
+            break;
+        case DECIDE_BID:
+            if (a.amount) {
+                cursor.highBidder = cursor.bidder;
+                cursor.bid = a.amount;
+                cursor.passesInARow = 0;
+            }
+            else if (++cursor.passesInARow == state.playerCount - 1) {
+                money_t owed = cursor.bid - state.players[cursor.highBidder].computeDiscount(upgradeEnum_t(cursor.upgrade));
+                if (owed > 0)
+                    ask(point,DECIDE_PAYMENT,cursor.highBidder,cursor.upgrade,0,owed);
+                else
+                    finishAuction(state,point);
+                return;
+            }
+            if (++cursor.bidder == state.playerCount)
+                cursor.bidder = 0;
+            break;
+        case DECIDE_FACTORIES:
+            if (!a.amount) {
+                p.computeExpectedIncome();
+                cursor.stage = TURN_COLONISTS;
+                break;
+            }
+            // the first turn's trade-in pays whatever the cards add up to
+            ask(point,DECIDE_PAYMENT,point.seat,UPGRADE_COUNT,a.which == NEW_CHEMICALS? a.amount : 0,
+                p.canTradeInForWater(cursor.round == 1) && a.which == WATER? p.totalCredits : a.amount * factoryCosts[a.which]);
+            p.factories[a.which] += a.amount;
+            return;
+        case DECIDE_COLONISTS:
+            cursor.stage = TURN_ROBOTS;
+            if (!a.amount)
+                break;
+            p.colonists += a.amount;
+            p.mannedByColonists[UNUSED] += a.amount;
+            ask(point,DECIDE_PAYMENT,point.seat,UPGRADE_COUNT,0,a.amount * p.getColonistPrice());
+            return;
+        case DECIDE_ROBOTS:
+            cursor.stage = TURN_PERSONNEL;
+            if (!a.amount)
+                break;
+            p.robots += a.amount;
+            p.mannedByRobots[UNUSED] += a.amount;
+            ask(point,DECIDE_PAYMENT,point.seat,UPGRADE_COUNT,0,a.amount * ROBOT_PRICE);
+            return;
+        case DECIDE_PAYMENT: {
+            card_t card = hand_t::slotCard(a.which);
+            p.removeCard(card);
+            discardToState(state,card);
+            point.amount -= card.value;
+            if (card.prodType == RESEARCH && point.limit)
+                point.limit--;
+            if (point.amount > 0 || point.limit)
+                return;
+            if (point.which != UPGRADE_COUNT)
+                return finishAuction(state,point);
+            break;
+        }
+        case DECIDE_PERSONNEL:
+        case DECIDE_OPERATOR: {
+            int from = a.which & ~PERSONNEL_ROBOT;
+            if (from != a.amount)
+                p.transferOperators(a.which & PERSONNEL_ROBOT? p.mannedByRobots : p.mannedByColonists,from,a.amount,1);
+            if (point.decision == DECIDE_PERSONNEL) {
+                if (from != a.amount)
+                    return;
+                cursor.turn++;
+                cursor.stage = TURN_STARTING;
+            }
+            p.computeExpectedIncome();
+            break;
+        }
+    }
+    nextDecision(state,point);
+}
+
+// Plays out the rest of a game inside a search.  It's the stock computer player (with the searcher's personality
+// in the searcher's seat), except that seat is told what to answer the first time it gets asked the decision being searched.
+class rolloutBrain_t: public computerBrain_t {
+    action_t forced;
+    bool takeForced(decisionEnum_t d) {
+        if (forced.decision != d)
+            return false;
+        forced.decision = DECIDE_NOTHING;
+        return true;
+    }
+public:
+    rolloutBrain_t(const game_t &theGame,const aiPersonality_t &personality) : computerBrain_t("*Rollout",theGame,personality) { 
+        forced.decision = DECIDE_NOTHING;
+    }
+    void force(const action_t &a) { forced = a; }
+    
+    cardIndex_t pickCardToAuction(hand_t &hand,vector<upgradeEnum_t> &upgradeMarket,money_t &bid) {
+        if (!takeForced(DECIDE_AUCTION))
+            return computerBrain_t::pickCardToAuction(hand,upgradeMarket,bid);
+        bid = forced.amount;
+        return forced.which;
+    }
+    money_t raiseOrPass(player_t &highBidder,hand_t &hand,upgradeEnum_t upgrade,money_t minBid) {
+        return takeForced(DECIDE_BID)? forced.amount : computerBrain_t::raiseOrPass(highBidder,hand,upgrade,minBid);
+    }
+    amt_t purchaseFactories(const vector<byte_t> &maxByType,productionEnum_t &whichFactory) {
+        if (!takeForced(DECIDE_FACTORIES))
+            return computerBrain_t::purchaseFactories(maxByType,whichFactory);
+        whichFactory = productionEnum_t(forced.which);
+        return forced.amount;
+    }
+    amt_t purchaseColonists(money_t perColonist,amt_t maxAllowed) {
+        return takeForced(DECIDE_COLONISTS)? forced.amount : computerBrain_t::purchaseColonists(perColonist,maxAllowed);
+    }
+    amt_t purchaseRobots(money_t perRobot,amt_t maxAllowed,amt_t maxUsable) {
+        return takeForced(DECIDE_ROBOTS)? forced.amount : computerBrain_t::purchaseRobots(perRobot,maxAllowed,maxUsable);
+    }
+};
+
+// Replaces everything the player in seat can't see with a random guess consistent with what they can:
+// the values of other players' production cards (their types are public knowledge) and the order of the
+// draw piles.  Hidden values are dealt from the cards that are neither discarded nor in our own hand, so
+// they always fall within the public bounds reported by getExpectedMoneyInHand.
+static void determinize(gameState_t &state,playerIndex_t seat,rng_t &rng) {
+    byte_t *drawPile = state.productionCards;
+    for (int t=ORE; t<PRODUCTION_COUNT; t++) {
+        byte_t pool[PRODUCTION_CARD_COUNT];
+        size_t poolSize = copy(drawPile, drawPile + state.drawPileSizes[t], pool) - pool;
+        // take the real cards of this type out of everybody else's hands, remembering how many each had.
+        amt_t hidden[MAX_PLAYERS];
+        for (playerIndex_t p=0; p<state.playerCount; p++) {
+            hidden[p] = 0;
+            for (size_t s=0; p!=seat && s<HAND_SLOTS; s++) {
+                const card_t &c = hand_t::slotCard(s);
+                if (c.prodType == t && c.returnToDiscard)
+                    while (state.players[p].hand.getCount(s)) {
+                        pool[poolSize++] = c.value;
+                        state.players[p].hand.remove(c);
+                        state.players[p].totalCredits -= c.value;
+                        hidden[p]++;
+                    }
+            }
+        }
+        rng.shuffle(pool, pool + poolSize);
+        
+        poolSize = 0;
+        for (playerIndex_t p=0; p<state.playerCount; p++)
+            for (amt_t n=0; n<hidden[p]; n++) {
+                card_t c = { pool[poolSize++], byte_t(t), deckSpecs[t].countsInHandSize, true };
+                state.players[p].hand.add(c);
+                state.players[p].totalCredits += c.value;
+            }
+        copy(pool + poolSize, pool + poolSize + state.drawPileSizes[t], drawPile);
+        drawPile += state.drawPileSizes[t] + state.discardPileSizes[t];
+    }
+}
+
+// Limits on how hard mctsBrain_t thinks about each decision.  The search stops at whichever limit
+// comes first; zero means no limit, but at least one of rollouts and milliseconds must be set.
+struct searchSettings_t {
+    unsigned rollouts;          // per decision, across all threads
+    unsigned milliseconds;      // per decision
+    unsigned threads;
+    unsigned horizon;           // rounds played out past the current one before a position is scored
+};
+
+struct searchStats_t {
+    unsigned visits;
+    double total;
+};
+
+/*
+    Information-set Monte Carlo search over the decisions where the stock computer player guesses the most:
+    which upgrade to auction, bids, factory purchases, and how many colonists and robots to buy.
+    Each rollout deals out a random version of everything we can't see (see determinize), restores it into
+    a scratch game with rolloutBrain_t in every seat, forces one of the candidate answers, and plays on for
+    a few rounds.  Candidates are picked by UCB1, so the tree is just the decision being made; the stock
+    computer player's heuristics choose everything else, both during rollouts and for our own other decisions.
+    Every search thread keeps its own scratch game and statistics, which are summed at the end.  The threads
+    and their scratch games are started with the first search and kept until the brain goes away.
+ */
+class mctsBrain_t: public computerBrain_t {
+    searchSettings_t settings;
+    rng_t rng;
+    vector<action_t> candidates;
+    
+    // One search thread's scratch game, with a rollout brain in every seat (which the game owns).
+    struct searcher_t {
+        game_t scratch;
+        vector<rolloutBrain_t*> brains;
+        searcher_t(playerIndex_t playerCount,playerIndex_t seat,const aiPersonality_t &personality) : scratch(playerCount,0) {
+            for (playerIndex_t p=0; p<playerCount; p++) {
+                brains.push_back(new rolloutBrain_t(scratch,p == seat? personality : defaultAi));
+                scratch.setPlayerBrain(p,*brains.back());
+            }
+        }
+    };
+    
+    // thread t searches with searchers[t] into stats from t * candidates.size() on; the caller's thread is thread 0.
+    vector<searcher_t*> searchers;
+    vector<thread> workers;
+    mutex lock;
+    condition_variable wake, finished;
+    unsigned generation, busy;
+    bool stopping;
+    // the search in progress
+    gameState_t root;
+    playerIndex_t seat;
+    vector<uint64_t> seeds;
+    unsigned perThread;
+    chrono::steady_clock::time_point deadline;
+    vector<searchStats_t> stats;
+    
+    void addCandidate(decisionEnum_t decision,size_t which,money_t amount) {
+        action_t a = { byte_t(decision), byte_t(which), amount };
+        if (find(candidates.begin(), candidates.end(), a) == candidates.end())
+            candidates.push_back(a);
+    }
+    
+    // Scores a finished or abandoned rollout from 0 to 1 for the player in seat.
+    static double evaluate(const game_t &game,playerIndex_t seat,bool gameOver) {
+        if (gameOver)
+            return game.getPlayerAtRank(0) == seat? 1.0 : 0.0;
+        // Otherwise compare our position against the best of the rest, figuring a victory point costs about 15$.
+        const vector<player_t> &players = game.getPlayers();
+        double ours = 0, best = -1e9;
+        for (playerIndex_t p=0; p<players.size(); p++) {
+            const player_t &pl = players[p];
+            double worth = 15.0 * pl.getVictoryPoints() + pl.getTotalCredits() + 2.0 * pl.getAverageIncome();
+            if (p == seat)
+                ours = worth;
+            else if (worth > best)
+                best = worth;
+        }
+        return 1.0 / (1.0 + exp((best - ours) / 60.0));
+    }
+    
+    void runSearch(unsigned t) {
+        rng_t threadRng(seeds[t]);
+        game_t &scratch = searchers[t]->scratch;
+        searchStats_t *threadStats = &stats[t * candidates.size()];
+        bool useDeadline = settings.milliseconds != 0;
+        gameState_t state;
+        size_t count = candidates.size();
+        for (unsigned r=0; (!perThread || r<perThread) && (!useDeadline || chrono::steady_clock::now() < deadline); r++) {
+            // UCB1, trying everything once first
+            size_t pick = 0;
+            double bestUcb = -1;
+            for (size_t c=0; c<count; c++) {
+                double ucb = threadStats[c].visits? threadStats[c].total / threadStats[c].visits + sqrt(2.0 * log(double(r)) / threadStats[c].visits) : 1e9;
+                if (ucb > bestUcb) {
+                    bestUcb = ucb;
+                    pick = c;
+                }
+            }
+            state = root;
+            determinize(state,seat,threadRng);
+            state.rngs.seed((uint64_t(threadRng.next()) << 32) | threadRng.next());
+            scratch.restoreState(state);
+            searchers[t]->brains[seat]->force(candidates[pick]);
+            amt_t rounds = scratch.resume(state.cursor.round + settings.horizon);
+            threadStats[pick].visits++;
+            threadStats[pick].total += evaluate(scratch,seat,rounds != 0);
+        }
+    }
+    
+    static void work(mctsBrain_t *m,unsigned t) {
+        table.setSink(NULL);
+        unique_lock<mutex> hold(m->lock);
+        for (unsigned seen=0;;) {
+            while (!m->stopping && m->generation == seen)
+                m->wake.wait(hold);
+            if (m->stopping)
+                return;
+            seen = m->generation;
+            hold.unlock();
+            m->runSearch(t);
+            hold.lock();
+            if (!--m->busy)
+                m->finished.notify_one();
+        }
+    }
+    
+    // Returns the index of the best of the candidates.
+    size_t search() {
+        if (candidates.size() == 1)
+            return 0;
+        game.saveState(root);
+        seat = playerIndex_t(player - &game.getPlayers()[0]);
+        unsigned threadCount = settings.threads? settings.threads : 1;
+        size_t count = candidates.size();
+        searchStats_t none = { 0, 0 };
+        stats.assign(threadCount * count, none);
+        deadline = chrono::steady_clock::now() + chrono::milliseconds(settings.milliseconds);
+        perThread = (settings.rollouts + threadCount - 1) / threadCount;
+        seeds.resize(threadCount);
+        // (thread 0's seed is drawn last.)
+        for (unsigned t=1; t<=threadCount; t++)
+            seeds[t % threadCount] = (uint64_t(rng.next()) << 32) | rng.next();
+        
+        // rollouts are neither narrated nor logged.
+        outputSink_t *sink = table.getSink();
+        table.setSink(NULL);
+        bool recording = events.isRecording();
+        events.setRecording(false);
+        if (searchers.empty()) {
+            for (unsigned t=0; t<threadCount; t++)
+                searchers.push_back(new searcher_t(root.playerCount,seat,ai));
+            for (unsigned t=1; t<threadCount; t++)
+                workers.push_back(thread(work,this,t));
+        }
+        {
+            lock_guard<mutex> hold(lock);
+            busy = unsigned(workers.size());
+            generation++;
+        }
+        wake.notify_all();
+        runSearch(0);
+        {
+            unique_lock<mutex> hold(lock);
+            while (busy)
+                finished.wait(hold);
+        }
+        for (unsigned t=1; t<threadCount; t++)
+            for (size_t c=0; c<count; c++) {
+                stats[c].visits += stats[t * count + c].visits;
+                stats[c].total += stats[t * count + c].total;
+            }
+        table.setSink(sink);
+        events.setRecording(recording);
+        
+        // most visited wins; UCB1 spends its visits on whatever looked best.
+        size_t best = 0;
+        for (size_t c=1; c<count; c++)
+            if (stats[c].visits > stats[best].visits)
+                best = c;
+        if (debugLevel > 0) {
+            debug << name << " searched:";
+            for (size_t c=0; c<count; c++)
+                debug << " " << int(candidates[c].which) << "/" << candidates[c].amount << " (" << stats[c].visits << " visits, " << int(stats[c].visits? 100 * stats[c].total / stats[c].visits : 0) << "%)";
+            debug << ".\n";
+        }
+        return best;
+    }
+public:
+    mctsBrain_t(string name,const game_t &theGame,const searchSettings_t &s,uint64_t seed,const aiPersonality_t &personality = defaultAi) :
+        computerBrain_t(name,theGame,personality), settings(s), rng(seed), generation(0), busy(0), stopping(false), seat(0), perThread(0) { }
+    ~mctsBrain_t() {
+        {
+            lock_guard<mutex> hold(lock);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (size_t t=0; t<workers.size(); t++)
+            workers[t].join();
+        for (size_t t=0; t<searchers.size(); t++)
+            delete searchers[t];
+    }
+    
+    cardIndex_t pickCardToAuction(hand_t &hand,vector<upgradeEnum_t> &upgradeMarket,money_t &bid) {
+        candidates.clear();
+        addCandidate(DECIDE_AUCTION,upgradeMarket.size(),0);
+        for (cardIndex_t i=0; i<upgradeMarket.size(); i++) {
+            money_t cost = upgradeCosts[upgradeMarket[i]];
+            money_t discount = player->computeDiscount(upgradeMarket[i]);
+            if (player->getTotalCredits() + discount >= cost)
+                addCandidate(DECIDE_AUCTION,i,discount >= cost? cost : findBestCards(cost - discount,hand,0,0) + discount);
+        }
+        const action_t &best = candidates[search()];
+        bid = best.amount;
+        return best.which;
+    }
+    money_t raiseOrPass(player_t &highBidder,hand_t &hand,upgradeEnum_t upgrade,money_t minBid) {
+        money_t discount = player->computeDiscount(upgrade);
+        if (player->getTotalCredits() + discount < minBid)
+            return 0;
+        candidates.clear();
+        addCandidate(DECIDE_BID,upgrade,0);
+        addCandidate(DECIDE_BID,upgrade,discount >= minBid? minBid : findBestCards(minBid - discount,hand,0,0) + discount);
+        money_t usual = computerBrain_t::raiseOrPass(highBidder,hand,upgrade,minBid);
+        if (usual)
+            addCandidate(DECIDE_BID,upgrade,usual);
+        // and a jump bid, in case scaring people off is worth it
+        if (player->getTotalCredits() + discount >= minBid + 10)
+            addCandidate(DECIDE_BID,upgrade,discount >= minBid + 10? minBid + 10 : findBestCards(minBid + 10 - discount,hand,0,0) + discount);
+        return candidates[search()].amount;
+    }
+    amt_t purchaseFactories(const vector<byte_t> &maxByType,productionEnum_t &whichFactory) {
+        candidates.clear();
+        addCandidate(DECIDE_FACTORIES,PRODUCTION_COUNT,0);
+        for (int i=ORE; i<=NEW_CHEMICALS; i++)
+            if (maxByType[i])
+                addCandidate(DECIDE_FACTORIES,i,1);
+        const action_t &best = candidates[search()];
+        whichFactory = productionEnum_t(best.which);
+        return best.amount;
+    }
+    amt_t purchaseColonists(money_t perColonist,amt_t maxAllowed) {
+        candidates.clear();
+        addCandidate(DECIDE_COLONISTS,0,0);
+        addCandidate(DECIDE_COLONISTS,0,computerBrain_t::purchaseColonists(perColonist,maxAllowed));
+        addCandidate(DECIDE_COLONISTS,0,1);
+        addCandidate(DECIDE_COLONISTS,0,maxAllowed);
+        return candidates[search()].amount;
+    }
+    amt_t purchaseRobots(money_t perRobot,amt_t maxAllowed,amt_t maxUsable) {
+        candidates.clear();
+        addCandidate(DECIDE_ROBOTS,0,0);
+        addCandidate(DECIDE_ROBOTS,0,computerBrain_t::purchaseRobots(perRobot,maxAllowed,maxUsable));
+        addCandidate(DECIDE_ROBOTS,0,1);
+        addCandidate(DECIDE_ROBOTS,0,maxUsable < maxAllowed? maxUsable : maxAllowed);
+        return candidates[search()].amount;
+    }
+};
+
+class playerBrain_t: public brain_t {
+    inputSource_t &in;
+    
+    unsigned readUnsigned() { return ::readUnsigned(in); }
+    char readLetter() { return ::readLetter(in); }
+public:
+    playerBrain_t(string name,inputSource_t &source = keyboard) : brain_t(name), in(source) { }
+    amt_t wantMega(productionEnum_t t,amt_t maxMega) {
+        for (;;) {
+            active << name << ", how many megaproduction cards for " << factoryNames[t] << " do you want (empty for none, at most " << maxMega << ")? ";
+            amt_t answer = readUnsigned();
+            if (answer == EMPTY)
+                return 0;
+            else if (answer <= maxMega)
+                return answer;
+            else
+                active << "That is too many megaproduction cards.\n";
+        }
+    }
+   cardIndex_t pickDiscard(hand_t &hand) {
+        active << name << ", you are over your hand limit.\n";
+        displayProductionCards(hand);
+        cardIndex_t which = 0;
+        do {
+            active << name << ", which card to you want to discard? (default is the cheapest) ";
+            which = readUnsigned();
+            if (which == EMPTY)
+                return cheapestDiscard(hand);
         } while (which >= hand.size());
         return which;
     }
-    cardIndex_t pickCardToAuction(vector<card_t> &hand,vector<upgradeEnum_t> &upgradeMarket,money_t &bid) {
+    cardIndex_t pickCardToAuction(hand_t &hand,vector<upgradeEnum_t> &upgradeMarket,money_t &bid) {
         for (;;) {
             for (cardIndex_t i=0; i<upgradeMarket.size(); i++) {
                 active << i << ". " << upgradeNames[upgradeMarket[i]] << " (min bid is " << int(upgradeCosts[upgradeMarket[i]]);
@@ -1652,13 +3886,13 @@ public:
             }
         }
     }
-    money_t raiseOrPass(player_t &,vector<card_t> &hand,upgradeEnum_t upgrade,money_t minBid) {
+    money_t raiseOrPass(player_t &,hand_t &hand,upgradeEnum_t upgrade,money_t minBid) {
         money_t discount = player->computeDiscount(upgrade);
         // don't bother asking if we cannot afford one higher than current bid
         if (player->getTotalCredits() < minBid - discount)
             return 0;
 
-        size_t best;
+        cardMask_t best;
         money_t recommendedBid = findBestCards(minBid-discount,hand,0,&best) + discount;
         displayProductionCardsOnSingleLine(hand,best);
         active << name << ", you have " << player->getTotalCredits() << " and a discount of " << discount << " on this upgrade.\n";
@@ -1678,7 +3912,7 @@ public:
                 return newBid;
         }
     }
-    money_t payFor(money_t cost,vector<card_t> &hand,bank_t &bank,amt_t minimumResearchCards) {
+    money_t payFor(money_t cost,hand_t &hand,bank_t &bank,amt_t minimumResearchCards) {
         money_t paid = 0;
         
         // if our total money minus our cheapest card is not enough to pay, toss everything
@@ -1699,7 +3933,7 @@ public:
             }
             else
                 active << name << ", you still need to discard " << minimumResearchCards << " more research cards!\n";
-            size_t best;
+            cardMask_t best;
             findBestCards(cost-paid,hand,minimumResearchCards,&best);
             displayProductionCards(hand,best);
             active << "Enter a card, by number, to discard: (or nothing to pick defaults) ";
@@ -1727,13 +3961,14 @@ public:
                     active << i << ". " << factoryNames[i] << " (at most " << int(maxByType[i]) << ", you have " << int(player->factories[i]) << ")" << "\n";
             displayProductionCardsOnSingleLine(player->hand);
             active << name << ", which factory would you like to purchase? (default is none) ";
-            whichFactory = (productionEnum_t) readUnsigned();
-            if (whichFactory == EMPTY)
+            unsigned which = readUnsigned();
+            if (which == EMPTY)
                 return 0;
-            if (whichFactory > NEW_CHEMICALS || !maxByType[whichFactory]) {
+            if (which > NEW_CHEMICALS || !maxByType[which]) {
                 active << "You cannot buy factories of that type.\n";
                 continue;
             }
+            whichFactory = productionEnum_t(which);
             active << "How many factories would you like to buy?  (default is " << int(maxByType[whichFactory]) << ") ";
             amt_t numToBuy = readUnsigned();
             if (numToBuy == EMPTY)
@@ -1779,7 +4014,6 @@ public:
         amt_t robotLimit = player->getRobotLimit();
         for (;;) {
             active << name << ", here are your current allocations:\n";
-            amt_t robotsInUse = player->getRobotsInUse();
             for (int i=ORE; i<PRODUCTION_COUNT; i++) {
                 if (player->factories[i])
                     active << i << ". " << factoryNames[i] << ": " << int(player->factories[i]) << " factories manned by " << int(player->mannedByColonists[i]) << " colonists and " << int(player->mannedByRobots[i]) << " robots.\n";
@@ -1791,7 +4025,7 @@ public:
                 return;
             operatorArray_t &manned = (cmd == 'C')? player->mannedByColonists : player->mannedByRobots;
             active << "Transfer source? ";
-            productionEnum_t src = (productionEnum_t)readUnsigned();
+            unsigned src = readUnsigned();
             if (src > UNUSED || !manned[src]) {
                 active << "Sorry, that is an invalid or empty transfer source.\n";
                 continue;
@@ -1803,144 +4037,3113 @@ public:
                 continue;
             }
             active << "Transfer destination? ";
-            productionEnum_t dst = (productionEnum_t)readUnsigned();
-            if (dst > UNUSED || (dst != UNUSED && player->factories[dst] < player->mannedByColonists[dst] + player->mannedByRobots[dst] + xferAmt)) {
+            unsigned dst = readUnsigned();
+            transferCheck_t check = player->checkTransfer(cmd == 'R',src,dst,xferAmt);
+            if (check == TRANSFER_NO_ROOM) {
                 active << "Sorry, that is an invalid transfer destination or there isn't enough room there.\n";
                 continue;
             }
-            else if (dst != UNUSED && src == UNUSED && cmd == 'R' && robotsInUse + xferAmt > robotLimit) {
+            else if (check == TRANSFER_ROBOT_LIMIT) {
                 active << "Sorry, that would place you over your robot limit of " << robotLimit << ".\n";
                 continue;
             }
-            else if (dst >= ORBITAL_MEDICINE && dst <= MOON_ORE && cmd == 'R') {
+            else if (check == TRANSFER_ROBOT_SPECIAL) {
                 active << "Sorry, you cannot staff robots at those Special Factories.\n";
                 continue;
             }
-            else if (src >= ORBITAL_MEDICINE && dst < ORBITAL_MEDICINE && player->colonists > player->colonistLimit) {
+            else if (check == TRANSFER_OVER_COLONIST_LIMIT) {
                 active << "Sorry, you cannot transfer from an era 3 upgrade to a lower upgrade when over your colonist limit.\n";
                 continue;
             }
             // otherwise, perform the transfer
-            manned[src] -= xferAmt;
-            manned[dst] += xferAmt;
+            player->transferOperators(manned,src,dst,xferAmt);
         }
     }
 };
 
-
-int main(int argc,char **argv) {
-    if (argc > 1 && !strncmp(argv[1],"-d",2))
-        debugLevel = atoi(argv[1]+2);
+// Every answer the brains in one game gave, in the order they were asked; together with the seed
+// that's enough to play the game again exactly, however the answers were arrived at.
+struct decisionLog_t {
+    unsigned seed;
+    amt_t maxRounds;            // as passed to game_t::play
+    amt_t rounds;               // what it returned
+    vector<string> names;       // one per seat
+    uint32_t computers;         // bit N is set if seat N was a computer player
+    vector<int32_t> words;      // each decision is its decisionEnum_t, seat, value count, then the values
+    size_t next;                // where a replay is up to
     
-    // display rules if no parameters on command line
-    if (argc == 1) {
-        table << basicRules;
-
-        table.setLeftMargin(4);
-        table << "Upgrade Summary:\n";
-        for (int i=0; i<UPGRADE_COUNT; i++) {
-            table << upgradeNames[i] << ": Min bid " << upgradeCosts[i] << ", ";
-            if (vpsForUpgrade[i])
-                table << vpsForUpgrade[i] << "VPs; ";
-            table << upgradeHelp[i] << ".\n";
-        }
-        table << "\nFactory Summary:\n";
-        for (int i=0; i<PRODUCTION_COUNT; i++) {
-            table << factoryNames[i] << ": ";
-            if (factoryCosts[i])
-                table << "Cost " << factoryCosts[i] << ", " ;
-            table << vpsForMannedFactory[i] << " VPs when operated; " << factoryHelp[i] << ".\n";
-        }
-        table << "\n";
-        table.setLeftMargin(0);
+    decisionLog_t() : seed(0), maxRounds(0), rounds(0), computers(0), next(0) { }
+    
+    void add(decisionEnum_t d,playerIndex_t seat,const int32_t *values,size_t count) {
+        words.push_back(d);
+        words.push_back(int32_t(seat));
+        words.push_back(int32_t(count));
+        words.insert(words.end(), values, values + count);
     }
     
-    table << "Built on " << __DATE__ << " at " << __TIME__ << ".\n";
+    // File layout is a header_t, each name as a length byte and the characters, then the words,
+    // all in host byte order.  Files hold any number of these back to back.
+    struct header_t {
+        char magic[4];          // "OPDL"
+        uint16_t version, playerCount;
+        uint32_t seed, maxRounds, rounds, wordCount;
+        uint32_t computers;
+    };
+    static const uint16_t VERSION = 3;        // 2: games draw from separate random streams (gameRngs_t); 3: computers
     
-    do {
-        unsigned playerCount;
-        
-        // seed the RNG, but let it be overridden from user input
-        unsigned seed = (unsigned) time(NULL);
-        
-        for (;;) {
-            table << "Number of players?  (2-9) ";
-            playerCount = readUnsigned();
-            if (playerCount >= 10 && playerCount < 20)
-                debugLevel = playerCount - 10;
-            else if (playerCount < 2 || playerCount > 9)
-                seed = playerCount;
-            else
-                break;
+    void save(outputSink_t &sink) const {
+        header_t h = { { 'O','P','D','L' }, VERSION, uint16_t(names.size()), seed, maxRounds, rounds, uint32_t(words.size()), computers };
+        sink.write((const char*)&h, sizeof(h));
+        for (size_t i=0; i<names.size(); i++) {
+            char len = char(names[i].size() < 255? names[i].size() : 255);
+            sink.write(&len, 1);
+            sink.write(names[i].data(), byte_t(len));
         }
+        if (words.size())
+            sink.write((const char*)&words[0], words.size() * sizeof(int32_t));
+    }
+    
+    // Returns false at the end of the file or if what's there isn't a decision log.
+    bool load(FILE *f) {
+        header_t h;
+        if (fread(&h, sizeof(h), 1, f) != 1 || memcmp(h.magic, "OPDL", 4) || h.version != VERSION || h.playerCount < 2 || h.playerCount > MAX_PLAYERS)
+            return false;
+        seed = h.seed;
+        maxRounds = h.maxRounds;
+        rounds = h.rounds;
+        computers = h.computers;
+        names.resize(h.playerCount);
+        for (size_t i=0; i<names.size(); i++) {
+            char buf[256];
+            int len = fgetc(f);
+            if (len == EOF || fread(buf, 1, len, f) != size_t(len))
+                return false;
+            names[i].assign(buf, len);
+        }
+        words.resize(h.wordCount);
+        next = 0;
+        return !h.wordCount || fread(&words[0], sizeof(int32_t), h.wordCount, f) == h.wordCount;
+    }
+};
 
-        table << "(using " << seed << " as RNG seed)" << "\n";
-        srand(seed);
+// Personnel decisions are recorded as where everybody ended up.
+static const size_t PERSONNEL_WORDS = 2 * (PRODUCTION_COUNT + 1);
 
-        game_t game(playerCount);
-        
-        vector<string> computerNames;
-        computerNames.push_back("*Alan T.");
-        computerNames.push_back("*Steve J.");
-        computerNames.push_back("*Grace H.");
-        computerNames.push_back("*Donald K.");
-        computerNames.push_back("*Dennis R.");
-        computerNames.push_back("*Bjarne S.");
-        computerNames.push_back("*Herb S.");
-        computerNames.push_back("*Bill G.");
-        computerNames.push_back("*James H.");
-        random_shuffle(computerNames.begin(), computerNames.end());
-      
-        // attach brains to each player
-        table << "If you enter an empty string for a name, that and all future players will be run by computer.  ";
-        table << "Players should be entered in seating order (aka auction bidding order).\n";
-        table.setLeftMargin(4);
-        
-        bool anyHumans = true;
-        for (int i=0; i<playerCount; i++) {
-            string name;
-            if (anyHumans) {
-                table << "Player " << i+1 << " name? ";
-                getline(cin,name);
-                if (name.size() == 0)
-                    anyHumans = false;
-            }
-            brain_t *thisBrain;
-            if (name.size() == 0) {
-                name = computerNames.back();
-                computerNames.pop_back();
-                thisBrain = new computerBrain_t(name,game);
-            }
-            else {
-                thisBrain = new playerBrain_t(name);
-                anyHumansInGame = true;
-            }
-                
-              game.setPlayerBrain(i,*thisBrain);
-        }
+static void savePersonnel(const player_t &p,int32_t *values) {
+    for (int i=ORE; i<=UNUSED; i++) {
+        values[i] = p.mannedByColonists[i];
+        values[PRODUCTION_COUNT + 1 + i] = p.mannedByRobots[i];
+    }
+}
 
-        // set up the play area, deal hands, etc
-        game.setupGame();
-        // do the first turn of the game (several phases are skipped)
-        game.displayPlayerOrder();
-        game.performPlayerTurns(true);
-        // game cannot possibly end but let's get vp's and turn order correct for second turn.
-        game.checkVictoryConditions();
-        amt_t round = 1;
-        
-        // now enter the normal turn progression
-        do {
-            ++round;
-            table << "\n\n";
-            table << "        =======================\n";
-            table << "        ===  R O U N D  " << ((round<10)?" ":"") << round << "  ===\n";
-            table << "        =======================\n\n";
-            game.displayPlayerOrder();
-            game.replaceUpgradeCards();
-            game.drawProductionCards();
-            game.discardExcessProductionCards();
-            game.performPlayerTurns(false);
-        } while (!game.checkVictoryConditions());
+// true if recorded staffing accounts for exactly the player's colonists and robots, at factories they have.
+static bool isValidPersonnel(const player_t &p,const int32_t *values) {
+    int32_t colonists = 0, robots = 0;
+    for (int i=ORE; i<=UNUSED; i++) {
+        int32_t c = values[i], r = values[PRODUCTION_COUNT + 1 + i];
+        if (c < 0 || r < 0 || (i != UNUSED && c + r > p.factories[i]))
+            return false;
+        colonists += c;
+        robots += r;
+    }
+    return colonists == p.colonists && robots == p.robots;
+}
+
+static void restorePersonnel(player_t &p,const int32_t *values) {
+    for (int i=ORE; i<=UNUSED; i++) {
+        p.mannedByColonists[i] = byte_t(values[i]);
+        p.mannedByRobots[i] = byte_t(values[PRODUCTION_COUNT + 1 + i]);
+    }
+    p.victoryPoints = p.computeVictoryPoints();
+}
+
+// Wraps any other brain, writing down everything it decides.
+class recordingBrain_t: public brain_t {
+    brain_t *inner;
+    decisionLog_t &log;
+    vector<int32_t> spent;      // cards given up so far in the payment in progress
+    bool paying;
+    
+    void add(decisionEnum_t d,const int32_t *values,size_t count) { log.add(d,player->seat,values,count); }
+    void add(decisionEnum_t d,int32_t value) { add(d,&value,1); }
+    void addPersonnel(decisionEnum_t d) {
+        int32_t values[PERSONNEL_WORDS];
+        savePersonnel(*player,values);
+        add(d,values,PERSONNEL_WORDS);
+    }
+public:
+    recordingBrain_t(brain_t &b,decisionLog_t &l) : brain_t(b.getName()), inner(&b), log(l), paying(false) { }
+    ~recordingBrain_t() { delete inner; }
+    
+    void setPlayer(player_t &p) {
+        brain_t::setPlayer(p);
+        inner->setPlayer(p);
+    }
+    void plan(turnphase_t phase) { inner->plan(phase); }
+    void discarding(cardIndex_t which) {
+        if (paying)
+            spent.push_back(int32_t(which));
+    }
+    
+    amt_t wantMega(productionEnum_t which,amt_t maxMega) {
+        amt_t answer = inner->wantMega(which,maxMega);
+        add(DECIDE_MEGA,answer);
+        return answer;
+    }
+    cardIndex_t pickDiscard(hand_t &hand) {
+        cardIndex_t answer = inner->pickDiscard(hand);
+        add(DECIDE_DISCARD,answer);
+        return answer;
+    }
+    cardIndex_t pickCardToAuction(hand_t &hand,vector<upgradeEnum_t> &upgradeMarket,money_t &bid) {
+        cardIndex_t answer = inner->pickCardToAuction(hand,upgradeMarket,bid);
+        int32_t values[2] = { int32_t(answer), bid };
+        add(DECIDE_AUCTION,values,2);
+        return answer;
+    }
+    money_t raiseOrPass(player_t &highBidder,hand_t &hand,upgradeEnum_t upgrade,money_t minBid) {
+        money_t answer = inner->raiseOrPass(highBidder,hand,upgrade,minBid);
+        add(DECIDE_BID,answer);
+        return answer;
+    }
+    money_t payFor(money_t cost,hand_t &hand,bank_t &bank,amt_t minimumResearchCards) {
+        spent.clear();
+        paying = true;
+        money_t answer = inner->payFor(cost,hand,bank,minimumResearchCards);
+        paying = false;
+        add(DECIDE_PAYMENT,spent.size()? &spent[0] : 0,spent.size());
+        return answer;
+    }
+    amt_t purchaseFactories(const vector<byte_t> &maxByType,productionEnum_t &whichFactory) {
+        amt_t answer = inner->purchaseFactories(maxByType,whichFactory);
+        // brains needn't set which factory when they don't want any.
+        int32_t values[2] = { int32_t(answer), answer? whichFactory : PRODUCTION_COUNT };
+        add(DECIDE_FACTORIES,values,2);
+        return answer;
+    }
+    amt_t purchaseColonists(money_t perColonist,amt_t maxAllowed) {
+        amt_t answer = inner->purchaseColonists(perColonist,maxAllowed);
+        add(DECIDE_COLONISTS,answer);
+        return answer;
+    }
+    amt_t purchaseRobots(money_t perRobot,amt_t maxAllowed,amt_t maxUsable) {
+        amt_t answer = inner->purchaseRobots(perRobot,maxAllowed,maxUsable);
+        add(DECIDE_ROBOTS,answer);
+        return answer;
+    }
+    void assignPersonnel() {
+        inner->assignPersonnel();
+        addPersonnel(DECIDE_PERSONNEL);
+    }
+    void moveOperatorToNewFactory(productionEnum_t newFactory) {
+        inner->moveOperatorToNewFactory(newFactory);
+        addPersonnel(DECIDE_OPERATOR);
+    }
+};
+
+// How a replayed game's recorded decisions compare with what the current computer player would do,
+// and where the log stopped matching the game, if it did.
+struct replayDifferences_t {
+    unsigned count;
+    string first;
+    string divergence;
+};
+
+// Gives back the answers from a decisionLog_t.  Optionally also asks a computer player what it would
+// do now and notes whenever that's different, which is how to find which games an AI change affects.
+class replayBrain_t: public brain_t {
+    decisionLog_t &log;
+    const game_t &game;
+    computerBrain_t *shadow;
+    computerBrain_t *fallback;      // answers once the log has diverged, so the game can still finish
+    replayDifferences_t *differences;
+    
+    // Notes the first place the log and the game part ways; runReplay reports it once the game is over.
+    void diverged(decisionEnum_t d) {
+        if (differences->divergence.empty()) {
+            char buf[256];
+            int len = snprintf(buf, sizeof(buf), "round %u: %s was asked for %s", player->cursor->round, name.c_str(), decisionNames[d]);
+            if (log.next + 3 <= log.words.size() && log.words[log.next] >= 0 && log.words[log.next] < DECIDE_COUNT)
+                snprintf(buf + len, sizeof(buf) - len, " but the log has %s for seat %d", decisionNames[log.words[log.next]], log.words[log.next+1] + 1);
+            else
+                snprintf(buf + len, sizeof(buf) - len, " but the log has ended");
+            differences->divergence = buf;
+        }
+        if (!fallback) {
+            fallback = new computerBrain_t(name,game);
+            fallback->setPlayer(*player);
+        }
+    }
+    // The values recorded for this decision, or NULL once the log has diverged.
+    const int32_t *take(decisionEnum_t d,size_t *count) {
+        if (fallback)
+            return NULL;
+        if (log.next + 3 > log.words.size() || log.words[log.next] != d || log.words[log.next+1] != int32_t(player->seat) ||
+            log.next + 3 + log.words[log.next+2] > log.words.size()) {
+            diverged(d);
+            return NULL;
+        }
+        *count = log.words[log.next+2];
+        const int32_t *values = &log.words[log.next + 3];
+        log.next += 3 + *count;
+        return values;
+    }
+    const int32_t *take(decisionEnum_t d,size_t expected) {
+        size_t count;
+        const int32_t *values = take(d,&count);
+        if (values && count != expected) {
+            diverged(d);
+            return NULL;
+        }
+        return values;
+    }
+    void compare(decisionEnum_t d,int recorded,int now) {
+        if (recorded == now)
+            return;
+        if (!differences->count++) {
+            char buf[128];
+            snprintf(buf, sizeof(buf), "round %u, %s %s: recorded %d, now %d", player->cursor->round, name.c_str(), decisionNames[d], recorded, now);
+            differences->first = buf;
+        }
+    }
+public:
+    replayBrain_t(string name,decisionLog_t &l,const game_t &g,computerBrain_t *s,replayDifferences_t *d) : brain_t(name), log(l), game(g), shadow(s), fallback(NULL), differences(d) { }
+    ~replayBrain_t() { 
+        delete shadow; 
+        delete fallback;
+    }
+    
+    void setPlayer(player_t &p) {
+        brain_t::setPlayer(p);
+        if (shadow)
+            shadow->setPlayer(p);
+    }
+    void plan(turnphase_t phase) {
+        if (shadow)
+            shadow->plan(phase);
+        if (fallback)
+            fallback->plan(phase);
+    }
+    
+    amt_t wantMega(productionEnum_t which,amt_t maxMega) {
+        const int32_t *values = take(DECIDE_MEGA,1);
+        if (values && amt_t(*values) > maxMega)
+            diverged(DECIDE_MEGA);
+        if (fallback)
+            return fallback->wantMega(which,maxMega);
+        amt_t answer = *values;
+        if (shadow)
+            compare(DECIDE_MEGA,answer,shadow->wantMega(which,maxMega));
+        return answer;
+    }
+    cardIndex_t pickDiscard(hand_t &hand) {
+        const int32_t *values = take(DECIDE_DISCARD,1);
+        if (values && cardIndex_t(*values) >= hand.size())
+            diverged(DECIDE_DISCARD);
+        if (fallback)
+            return fallback->pickDiscard(hand);
+        cardIndex_t answer = *values;
+        if (shadow)
+            compare(DECIDE_DISCARD,answer,shadow->pickDiscard(hand));
+        return answer;
+    }
+    cardIndex_t pickCardToAuction(hand_t &hand,vector<upgradeEnum_t> &upgradeMarket,money_t &bid) {
+        const int32_t *values = take(DECIDE_AUCTION,2);
+        if (values && (cardIndex_t(values[0]) > upgradeMarket.size() || values[1] < 0))
+            diverged(DECIDE_AUCTION);
+        if (fallback)
+            return fallback->pickCardToAuction(hand,upgradeMarket,bid);
+        if (shadow) {
+            money_t shadowBid = 0;
+            cardIndex_t shadowAnswer = shadow->pickCardToAuction(hand,upgradeMarket,shadowBid);
+            compare(DECIDE_AUCTION,values[0],shadowAnswer);
+            if (values[0] == int32_t(shadowAnswer) && shadowAnswer != upgradeMarket.size())
+                compare(DECIDE_AUCTION,values[1],shadowBid);
+        }
+        bid = values[1];
+        return values[0];
+    }
+    money_t raiseOrPass(player_t &highBidder,hand_t &hand,upgradeEnum_t upgrade,money_t minBid) {
+        const int32_t *values = take(DECIDE_BID,1);
+        if (values && *values && *values < minBid)
+            diverged(DECIDE_BID);
+        if (fallback)
+            return fallback->raiseOrPass(highBidder,hand,upgrade,minBid);
+        money_t answer = *values;
+        if (shadow)
+            compare(DECIDE_BID,answer,shadow->raiseOrPass(highBidder,hand,upgrade,minBid));
+        return answer;
+    }
+    money_t payFor(money_t cost,hand_t &hand,bank_t &bank,amt_t minimumResearchCards) {
+        size_t count;
+        const int32_t *values = take(DECIDE_PAYMENT,&count);
+        // every card must still be there by the time it's spent; the hand shrinks by one each time.
+        for (size_t i=0; values && i<count; i++)
+            if (values[i] < 0 || cardIndex_t(values[i]) + i >= hand.size()) {
+                diverged(DECIDE_PAYMENT);
+                values = NULL;
+            }
+        if (!values)
+            return fallback->payFor(cost,hand,bank,minimumResearchCards);
+        money_t paid = 0;
+        for (size_t i=0; i<count; i++) {
+            paid += hand[values[i]].value;
+            player->discardCard(bank,values[i]);
+        }
+        return paid;
+    }
+    amt_t purchaseFactories(const vector<byte_t> &maxByType,productionEnum_t &whichFactory) {
+        const int32_t *values = take(DECIDE_FACTORIES,2);
+        if (values && values[0] && (values[1] < 0 || size_t(values[1]) >= maxByType.size() || amt_t(values[0]) > maxByType[values[1]]))
+            diverged(DECIDE_FACTORIES);
+        if (fallback)
+            return fallback->purchaseFactories(maxByType,whichFactory);
+        if (shadow) {
+            productionEnum_t shadowFactory = PRODUCTION_COUNT;
+            amt_t shadowAnswer = shadow->purchaseFactories(maxByType,shadowFactory);
+            compare(DECIDE_FACTORIES,values[0],shadowAnswer);
+            if (values[0] && shadowAnswer)
+                compare(DECIDE_FACTORIES,values[1],shadowFactory);
+        }
+        whichFactory = productionEnum_t(values[1]);
+        return values[0];
+    }
+    amt_t purchaseColonists(money_t perColonist,amt_t maxAllowed) {
+        const int32_t *values = take(DECIDE_COLONISTS,1);
+        if (values && amt_t(*values) > maxAllowed)
+            diverged(DECIDE_COLONISTS);
+        if (fallback)
+            return fallback->purchaseColonists(perColonist,maxAllowed);
+        amt_t answer = *values;
+        if (shadow)
+            compare(DECIDE_COLONISTS,answer,shadow->purchaseColonists(perColonist,maxAllowed));
+        return answer;
+    }
+    amt_t purchaseRobots(money_t perRobot,amt_t maxAllowed,amt_t maxUsable) {
+        const int32_t *values = take(DECIDE_ROBOTS,1);
+        if (values && amt_t(*values) > maxAllowed)
+            diverged(DECIDE_ROBOTS);
+        if (fallback)
+            return fallback->purchaseRobots(perRobot,maxAllowed,maxUsable);
+        amt_t answer = *values;
+        if (shadow)
+            compare(DECIDE_ROBOTS,answer,shadow->purchaseRobots(perRobot,maxAllowed,maxUsable));
+        return answer;
+    }
+    void assignPersonnel() {
+        const int32_t *values = take(DECIDE_PERSONNEL,PERSONNEL_WORDS);
+        if (values && !isValidPersonnel(*player,values))
+            diverged(DECIDE_PERSONNEL);
+        if (!fallback)
+            restorePersonnel(*player,values);
+        else
+            fallback->assignPersonnel();
+    }
+    void moveOperatorToNewFactory(productionEnum_t newFactory) {
+        const int32_t *values = take(DECIDE_OPERATOR,PERSONNEL_WORDS);
+        if (values && !isValidPersonnel(*player,values))
+            diverged(DECIDE_OPERATOR);
+        if (!fallback)
+            restorePersonnel(*player,values);
+        else
+            fallback->moveOperatorToNewFactory(newFactory);
+    }
+};
+
+struct replayOptions_t {
+    const char *fileName;
+    unsigned game;          // only replay this one (counting from 1), or zero for all of them
+    unsigned round;         // stop after this round and show everything, or zero to play to the end
+    bool compare;           // check recorded computer decisions against the current computer player
+};
+
+// Plays back every game in a file written with --record, without narration, checking that each one
+// goes exactly as it did before.
+static int runReplay(const replayOptions_t &options) {
+    FILE *f = fopen(options.fileName,"rb");
+    if (!f) {
+        printf("Can't read %s.\n", options.fileName);
+        return 1;
+    }
+    outputSink_t *sink = table.getSink();
+    decisionLog_t log;
+    unsigned replayed = 0, withDifferences = 0;
+    for (unsigned g=1; log.load(f); g++) {
+        if (options.game && g != options.game)
+            continue;
+        table.setSink(NULL);
+        game_t game(log.names.size(),log.seed);
+        replayDifferences_t differences = { 0, string(), string() };
+        for (playerIndex_t i=0; i<log.names.size(); i++) {
+            computerBrain_t *shadow = options.compare && (log.computers >> i & 1)? new computerBrain_t(log.names[i],game) : 0;
+            game.setPlayerBrain(i,*new replayBrain_t(log.names[i],log,game,shadow,&differences));
+        }
+        bool stopEarly = options.round && (!log.maxRounds || options.round < log.maxRounds);
+        amt_t rounds = game.play(stopEarly? options.round : log.maxRounds);
+        table.setSink(sink);
+        ++replayed;
+        printf("Game %u, seed %u: ", g, log.seed);
+        // a divergence before the round asked for is still a divergence.
+        if (differences.divergence.size()) {
+            printf("diverged in %s.\n", differences.divergence.c_str());
+            fclose(f);
+            return 1;
+        }
+        else if (stopEarly && !rounds)
+            printf("stopped after round %u", options.round);
+        else if (rounds != log.rounds || log.next != log.words.size()) {
+            printf("diverged; recorded %u rounds and %u decision words, replayed %u and %u.\n", log.rounds, unsigned(log.words.size()), rounds, unsigned(log.next));
+            fclose(f);
+            return 1;
+        }
+        else if (rounds)
+            printf("%u rounds, %s wins with %u VPs", rounds, log.names[game.getPlayerAtRank(0)].c_str(), game.getVictoryPointsAtRank(0));
+        else
+            printf("abandoned after %u rounds", log.maxRounds);
+        if (differences.count) {
+            printf("; %u decision%s differ, first %s", differences.count, differences.count>1?"s":"", differences.first.c_str());
+            ++withDifferences;
+        }
+        printf(".\n");
+        if (stopEarly && !rounds) {
+            fflush(stdout);
+            game.displayState();
+            table.flush();
+        }
+        if (options.game)
+            break;
+    }
+    fclose(f);
+    printf("%u game%s replayed", replayed, replayed==1?"":"s");
+    if (options.compare)
+        printf(", %u with different decisions", withDifferences);
+    printf(".\n");
+    return 0;
+}
+
+// Games that haven't finished after this many rounds are abandoned by batch runs.
+static const amt_t maxBatchRounds = 500;
+
+// Aggregate results of many computer-only games.
+// Totals are kept per brain: the brain set up for seat N (its personality, or a search) sits there unless
+// seats are being rotated, when it moves one seat further round the table each game.
+class batchResults_t {
+    static const unsigned VP_BUCKETS = 12;      // 10 VPs per bucket, last one is open-ended
+    unsigned playerCount, gamesPlayed, gamesAbandoned;
+    unsigned long totalRounds;
+    amt_t minRounds, maxRounds;
+    vector<unsigned> wins;
+    vector<unsigned long> totalVps;
+    vector<unsigned> allVpHistogram, winnerVpHistogram;
+    vector<unsigned> pairWins;                  // [i * playerCount + j] is how often brain i finished above brain j
+    
+    static unsigned bucketOf(unsigned vps) { return vps/10 < VP_BUCKETS? vps/10 : VP_BUCKETS-1; }
+public:
+    batchResults_t(unsigned pc) : playerCount(pc), gamesPlayed(0), gamesAbandoned(0), totalRounds(0), minRounds(0), maxRounds(0) {
+        wins.resize(pc);
+        totalVps.resize(pc);
+        allVpHistogram.resize(VP_BUCKETS);
+        winnerVpHistogram.resize(VP_BUCKETS);
+        pairWins.resize(pc * pc);
+    }
+    
+    // Brain b sat at seat (b + rotation) % playerCount.
+    void addGame(const game_t &game,amt_t rounds,unsigned rotation) {
+        if (!rounds) {
+            ++gamesAbandoned;
+            return;
+        }
+        ++gamesPlayed;
+        totalRounds += rounds;
+        if (!minRounds || rounds < minRounds)
+            minRounds = rounds;
+        if (rounds > maxRounds)
+            maxRounds = rounds;
+        unsigned brains[MAX_PLAYERS];
+        for (size_t r=0; r<playerCount; r++)
+            brains[r] = (game.getPlayerAtRank(r) + playerCount - rotation) % playerCount;
+        wins[brains[0]]++;
+        winnerVpHistogram[bucketOf(game.getVictoryPointsAtRank(0))]++;
+        for (size_t r=0; r<playerCount; r++) {
+            unsigned vps = game.getVictoryPointsAtRank(r);
+            totalVps[brains[r]] += vps;
+            allVpHistogram[bucketOf(vps)]++;
+            for (size_t below=r+1; below<playerCount; below++)
+                pairWins[brains[r] * playerCount + brains[below]]++;
+        }
+    }
+    
+    void merge(const batchResults_t &that) {
+        gamesPlayed += that.gamesPlayed;
+        gamesAbandoned += that.gamesAbandoned;
+        totalRounds += that.totalRounds;
+        if (that.minRounds && (!minRounds || that.minRounds < minRounds))
+            minRounds = that.minRounds;
+        if (that.maxRounds > maxRounds)
+            maxRounds = that.maxRounds;
+        for (unsigned i=0; i<playerCount; i++) {
+            wins[i] += that.wins[i];
+            totalVps[i] += that.totalVps[i];
+        }
+        for (unsigned b=0; b<VP_BUCKETS; b++) {
+            allVpHistogram[b] += that.allVpHistogram[b];
+            winnerVpHistogram[b] += that.winnerVpHistogram[b];
+        }
+        for (size_t i=0; i<pairWins.size(); i++)
+            pairWins[i] += that.pairWins[i];
+    }
+    
+    // Ratings on the Elo scale from every pair of brains in every game (a Bradley-Terry fit, by the usual
+    // minorize-maximize iteration), centered on zero.  Each pair starts with half a win each way so that
+    // a brain that never finished above (or below) another still gets a finite rating.
+    vector<double> eloRatings() const {
+        vector<double> strength(playerCount,1.0);
+        for (unsigned pass=0; pass<200; pass++) {
+            double logSum = 0;
+            for (unsigned i=0; i<playerCount; i++) {
+                double won = 0, weighted = 0;
+                for (unsigned j=0; j<playerCount; j++)
+                    if (j != i) {
+                        won += pairWins[i * playerCount + j] + 0.5;
+                        weighted += (pairWins[i * playerCount + j] + pairWins[j * playerCount + i] + 1.0) / (strength[i] + strength[j]);
+                    }
+                strength[i] = won / weighted;
+                logSum += log(strength[i]);
+            }
+            for (unsigned i=0; i<playerCount; i++)
+                strength[i] /= exp(logSum / playerCount);
+        }
+        vector<double> elo(playerCount);
+        for (unsigned i=0; i<playerCount; i++)
+            elo[i] = 400 * log10(strength[i]);
+        return elo;
+    }
+    
+    void report(bool rotated) const {
+        printf("%u games finished", gamesPlayed);
+        if (gamesAbandoned)
+            printf(", %u abandoned after %u rounds", gamesAbandoned, maxBatchRounds);
+        printf(".\n");
+        if (!gamesPlayed)
+            return;
+        printf("Rounds: average %.2f, fewest %u, most %u.\n\n", double(totalRounds) / gamesPlayed, minRounds, maxRounds);
+        // with a 95% Wilson score interval on the win rate, which stays sensible for rates near 0 or 1
+        vector<double> elo = eloRatings();
+        printf("%s   Wins     Win%%    95%% interval   Avg VPs     Elo\n", rotated? "Brain" : " Seat");
+        for (unsigned i=0; i<playerCount; i++) {
+            double n = gamesPlayed, p = wins[i] / n, z = 1.96;
+            double center = (p + z * z / (2 * n)) / (1 + z * z / n);
+            double half = z * sqrt(p * (1 - p) / n + z * z / (4 * n * n)) / (1 + z * z / n);
+            printf("%5u %6u %7.2f%%   %5.2f%%-%5.2f%% %9.2f %+7.1f\n", i+1, wins[i], 100 * p, 100 * (center - half), 100 * (center + half),
+                   double(totalVps[i]) / gamesPlayed, elo[i]);
+        }
+        printf("\nVPs      All seats      Winners\n");
+        for (unsigned b=0; b<VP_BUCKETS; b++) {
+            char label[16];
+            if (b == VP_BUCKETS-1)
+                sprintf(label,"%u+",b*10);
+            else
+                sprintf(label,"%u-%u",b*10,b*10+9);
+            printf("%-7s %7.2f%% %11.2f%%\n", label, 100.0 * allVpHistogram[b] / (gamesPlayed * playerCount), 100.0 * winnerVpHistogram[b] / gamesPlayed);
+        }
+    }
+};
+
+struct batchOptions_t {
+    unsigned games, playerCount, seed, threads;
+    unsigned searchSeats;           // this many brains, starting with the first, are mctsBrain_t
+    searchSettings_t search;
+    const char *logName;            // if set, every game's narration is written here
+    const char *eventsName;         // and every game's events here
+    bool eventsJson;                // as JSON lines rather than binary
+    const char *recordName;         // and every game's decisions here, to be replayed with --replay
+    const aiPersonality_t *personalities[MAX_PLAYERS];     // for computer seats; the default where NULL
+    bool rotate;                    // move every brain one seat round the table each game
+    bool duplicate;                 // and deal each seed once per seat, so every brain plays every deal from every seat
+    bool sprt;                      // stop as soon as brain 1 is shown to be about sprtElo0 or sprtElo1 stronger than the rest
+    double sprtElo0, sprtElo1;
+    
+    batchOptions_t() : games(0), playerCount(4), seed((unsigned) time(NULL)), threads(thread::hardware_concurrency()), searchSeats(0),
+            logName(NULL), eventsName(NULL), eventsJson(false), recordName(NULL), rotate(false), duplicate(false), sprt(false), sprtElo0(0), sprtElo1(0) {
+        search.rollouts = 200;
+        search.milliseconds = 0;
+        search.threads = 1;
+        search.horizon = 2;
+        for (size_t i=0; i<MAX_PLAYERS; i++)
+            personalities[i] = NULL;
+    }
+};
+
+// Narration and events from all the batch workers.  Each game is collected separately and appended whole,
+// so games are never interleaved, though they appear in the order they finished.
+struct batchLog_t {
+    fileSink_t *narration, *events, *decisions;
+    mutex lock;
+};
+
+/*
+    A sequential probability ratio test of brain 1 against the rest of the table, so a comparison can stop as
+    soon as it's decided rather than running a fixed number of games.  Each game scores brain 1 the fraction
+    of the other brains it finished above, which for a brain d Elo stronger than the field averages
+    1 / (1 + 10^(-d/400)); the test weighs d = elo0 against d = elo1 with the normal approximation of the
+    generalized SPRT, as chess engine testing does, with a 5% chance of each kind of mistake.
+
+    Games are taken strictly in order whichever thread finished them, so the verdict and the game it came at
+    don't depend on the number of threads (games already under way when it comes still appear in the totals).
+    When duplicating, each deal's set of games is averaged into one score, since games from the same deal
+    aren't independent; a verdict only comes at the end of a set.
+*/
+struct sprtState_t {
+    enum { UNPLAYED = -1, ABANDONED = -2 };      // in places, for games not yet counted
+    static const unsigned MIN_GAMES = 50;       // before the variance is trusted
+    double elo0, elo1;
+    unsigned playerCount, setSize;
+    vector<int> places;             // for each game, how many brains brain 1 finished above
+    unsigned counted, scored;       // games taken in order so far, and how many scores (sets with a finished game) those made
+    unsigned setFinished;           // finished games in the set so far
+    double setSum;
+    double sum, squares, llr;
+    int verdict;                    // 1 once elo1 is accepted, -1 once elo0 is, 0 while undecided
+    atomic<unsigned> stopAt;        // no game from here on is started
+    mutex lock;
+    
+    sprtState_t(double e0,double e1,unsigned pc,unsigned set,unsigned games) : elo0(e0), elo1(e1), playerCount(pc), setSize(set),
+        places(games,int(UNPLAYED)), counted(0), scored(0), setFinished(0), setSum(0), sum(0), squares(0), llr(0), verdict(0), stopAt(games) { }
+    
+    static double expectedScore(double elo) { return 1 / (1 + pow(10.0,-elo / 400)); }
+    static double lowerBound() { return log(0.05 / 0.95); }
+    static double upperBound() { return log(0.95 / 0.05); }
+    
+    void addGame(unsigned game,int placesAbove) {
+        lock_guard<mutex> hold(lock);
+        places[game] = placesAbove;
+        while (!verdict && counted < places.size() && places[counted] != UNPLAYED) {
+            int p = places[counted++];
+            if (p != ABANDONED) {
+                setSum += double(p) / (playerCount - 1);
+                setFinished++;
+            }
+            if (counted % setSize || !setFinished)
+                continue;
+            double x = setSum / setFinished;
+            setSum = 0;
+            setFinished = 0;
+            scored++;
+            sum += x;
+            squares += x * x;
+            double mean = sum / scored, variance = squares / scored - mean * mean;
+            if (scored < MIN_GAMES || variance <= 0)
+                continue;
+            double s0 = expectedScore(elo0), s1 = expectedScore(elo1);
+            llr = scored * (s1 - s0) * (2 * mean - s0 - s1) / (2 * variance);
+            if (llr >= upperBound())
+                verdict = 1;
+            else if (llr <= lowerBound())
+                verdict = -1;
+            if (verdict)
+                stopAt = counted;
+        }
+    }
+    
+    void report() const {
+        printf("\nSPRT, brain 1 against the rest at %+g or %+g Elo: ", elo0, elo1);
+        if (verdict)
+            printf("%+g accepted", verdict > 0? elo1 : elo0);
+        else
+            printf("undecided");
+        printf(" after %u games (%u %s), LLR %.2f, bounds %.2f to %.2f.\n", counted, scored, setSize > 1? "deals scored" : "finished", llr, lowerBound(), upperBound());
+    }
+};
+
+// Batch mode: plays many games between computer players with narration turned off unless it's being logged.
+// Game N is seeded with seed+N so any single game can be replayed interactively (or seed+N/players when
+// duplicating, where games come in sets of one deal with the brains rotated through every seat).
+// Worker threads each claim the next unplayed game as they finish one, and keep their own totals
+// which are merged at the end; the totals don't depend on how many threads there were.
+static void playBatchGames(atomic<unsigned> *nextGame,const batchOptions_t *options,batchLog_t *log,batchResults_t *results,sprtState_t *sprt) {
+    stringSink_t narration;
+    outputSink_t *sink = table.getSink();
+    table.setSink(log->narration? &narration : NULL);
+    events.setRecording(log->events != NULL);
+    for (unsigned g; (g = (*nextGame)++) < options->games && (!sprt || g < sprt->stopAt); ) {
+        unsigned seed = options->seed + (options->duplicate? g / options->playerCount : g);
+        // brain b sits at seat (b + rotation) % playerCount
+        unsigned rotation = options->rotate? g % options->playerCount : 0;
+        table << "=== Game " << g+1 << ", seed " << seed << " ===\n";
+        events.beginGame(seed,options->playerCount);
+        game_t game(options->playerCount,seed);
+        decisionLog_t decisions;
+        decisions.seed = seed;
+        decisions.maxRounds = maxBatchRounds;
+        for (unsigned i=0; i<options->playerCount; i++) {
+            unsigned b = (i + options->playerCount - rotation) % options->playerCount;
+            char name[16];
+            sprintf(name,options->rotate? "*Brain %u" : "*Seat %u",b+1);
+            brain_t *brain;
+            const aiPersonality_t &ai = options->personalities[b]? *options->personalities[b] : defaultAi;
+            if (b < options->searchSeats)
+                brain = new mctsBrain_t(name,game,options->search,(uint64_t(seed) << 8) | b,ai);
+            else
+                brain = new computerBrain_t(name,game,ai);
+            if (log->decisions) {
+                brain = new recordingBrain_t(*brain,decisions);
+                decisions.names.push_back(name);
+                decisions.computers |= 1U << i;
+            }
+            game.setPlayerBrain(i,*brain);
+        }
+        decisions.rounds = game.play(maxBatchRounds);
+        results->addGame(game,decisions.rounds,rotation);
+        if (sprt) {
+            int placesAbove = sprtState_t::ABANDONED;
+            if (decisions.rounds)
+                for (unsigned r=0; r<options->playerCount; r++)
+                    if (game.getPlayerAtRank(r) == rotation)
+                        placesAbove = options->playerCount - 1 - r;
+            sprt->addGame(g,placesAbove);
+        }
+        table << "\n";
+        if (log->narration || log->events || log->decisions) {
+            lock_guard<mutex> hold(log->lock);
+            if (log->decisions)
+                decisions.save(*log->decisions);
+            if (log->narration) {
+                log->narration->write(narration.text.data(),narration.text.size());
+                narration.text.clear();
+            }
+            if (log->events) {
+                if (options->eventsJson)
+                    events.writeJson(*log->events);
+                else
+                    events.writeBinary(*log->events);
+            }
+        }
+    }
+    table.setSink(sink);
+    events.setRecording(false);
+}
+
+static fileSink_t *openLogFile(const char *name,bool append = false) {
+    FILE *f = fopen(name,append? "ab" : "wb");
+    if (!f) {
+        printf("Can't write %s.\n", name);
+        return NULL;
+    }
+    return new fileSink_t(f);
+}
+
+static void runBatch(const batchOptions_t &options) {
+    unsigned threadCount = options.threads < options.games? options.threads : options.games;
+    atomic<unsigned> nextGame(0);
+    vector<batchResults_t> results(threadCount,batchResults_t(options.playerCount));
+    unsigned setSize = options.duplicate? options.playerCount : 1;
+    sprtState_t *sprt = options.sprt? new sprtState_t(options.sprtElo0,options.sprtElo1,options.playerCount,setSize,options.games) : NULL;
+    batchLog_t log;
+    log.narration = log.events = log.decisions = NULL;
+    if ((options.logName && !(log.narration = openLogFile(options.logName))) ||
+        (options.recordName && !(log.decisions = openLogFile(options.recordName,true))) ||
+        (options.eventsName && !(log.events = openLogFile(options.eventsName)))) {
+        // don't leave the logs that did open behind
+        delete log.narration;
+        delete log.decisions;
+        delete sprt;
+        return;
+    }
+    if (log.events && !options.eventsJson)
+        eventLog_t::writeHeader(*log.events);
+    vector<thread> workers;
+    for (unsigned t=1; t<threadCount; t++)
+        workers.push_back(thread(playBatchGames,&nextGame,&options,&log,&results[t],sprt));
+    playBatchGames(&nextGame,&options,&log,&results[0],sprt);
+    for (unsigned t=1; t<threadCount; t++) {
+        workers[t-1].join();
+        results[0].merge(results[t]);
+    }
+    delete log.narration;
+    delete log.events;
+    delete log.decisions;
+    // each worker's last claim is the one it didn't play, whether past the last game or after an SPRT stopped
+    unsigned started = nextGame - threadCount;
+    unsigned deals = (started + setSize - 1) / setSize;
+    printf("%u players, seeds %u-%u, %u thread%s", options.playerCount, options.seed, options.seed + deals - 1, threadCount, threadCount>1?"s":"");
+    if (options.searchSeats)
+        printf(", %s 1-%u search (%u rollouts, %ums, %u threads, %u round horizon)", options.rotate? "brains" : "seats", options.searchSeats,
+               options.search.rollouts, options.search.milliseconds, options.search.threads, options.search.horizon);
+    for (unsigned i=0; i<options.playerCount; i++)
+        if (options.personalities[i])
+            printf(", %s %u has its own personality", options.rotate? "brain" : "seat", i+1);
+    if (options.duplicate)
+        printf(", every deal played from every seat");
+    else if (options.rotate)
+        printf(", brains change seats every game");
+    printf("\n");
+    results[0].report(options.rotate);
+    if (sprt)
+        sprt->report();
+    delete sprt;
+}
+
+/*
+    Tuning.  Looks for a better computer brain personality by self-play, with a separable CMA-ES: an
+    evolution strategy that keeps a mean personality and a spread for each setting, samples a population
+    around the mean each generation, moves the mean toward the candidates that did best, and widens or
+    narrows the spreads by how consistently it has been moving (unlike the full CMA-ES it doesn't learn how
+    settings interact, which with thirty of them would need far more games than it saves).  Settings are
+    searched in units of their starting values, then rounded and held to their ranges to be played.
+
+    Every candidate in a generation plays the same games, with the same seeds and taking each seat in turn,
+    against copies of the current mean, so that differences in score come from the personalities rather than
+    the deal.  A game scores 1 for first place down to 0 for last, in whole places (so the totals are exact and
+    don't depend on how many threads played them).  Each generation gets fresh seeds so the mean can't learn
+    its way around one particular set of deals.
+*/
+struct tuneOptions_t {
+    unsigned generations;
+    unsigned population;            // candidates per generation; 0 picks the usual size for the number of settings
+    unsigned games;                 // each candidate plays per generation, rounded up to a multiple of the players
+    const char *outName;            // if set, the tuned personality is written here
+};
+
+// Totals for each candidate in a match, in places above last.
+struct tuneScores_t {
+    vector<uint64_t> places, squares;
+    vector<unsigned> wins;
+    tuneScores_t(size_t candidates) : places(candidates), squares(candidates), wins(candidates) { }
+    void merge(const tuneScores_t &other) {
+        for (size_t c=0; c<places.size(); c++) {
+            places[c] += other.places[c];
+            squares[c] += other.squares[c];
+            wins[c] += other.wins[c];
+        }
+    }
+};
+
+struct tuneMatch_t {
+    const aiPersonality_t *candidates;
+    size_t candidateCount;
+    const aiPersonality_t *opponent;
+    unsigned playerCount, firstSeed, games;
+    atomic<unsigned> nextGame;
+};
+
+static void playTuneGames(tuneMatch_t *match,tuneScores_t *scores) {
+    outputSink_t *sink = table.getSink();
+    table.setSink(NULL);
+    unsigned total = unsigned(match->candidateCount) * match->games;
+    for (unsigned g; (g = match->nextGame++) < total; ) {
+        size_t c = g / match->games;
+        unsigned n = g % match->games;
+        playerIndex_t seat = n % match->playerCount;
+        game_t game(match->playerCount,match->firstSeed + n);
+        for (unsigned i=0; i<match->playerCount; i++) {
+            if (i == seat)
+                game.setPlayerBrain(i,*new computerBrain_t("*Candidate",game,match->candidates[c]));
+            else
+                game.setPlayerBrain(i,*new computerBrain_t("*Mean",game,*match->opponent));
+        }
+        game.play(maxBatchRounds);
+        unsigned rank = 0;
+        while (game.getPlayerAtRank(rank) != seat)
+            rank++;
+        unsigned places = match->playerCount - 1 - rank;
+        scores->places[c] += places;
+        scores->squares[c] += places * places;
+        if (!rank)
+            scores->wins[c]++;
+    }
+    table.setSink(sink);
+}
+
+// Plays every candidate through the same games against the opponent.
+static tuneScores_t playTuneMatch(const aiPersonality_t *candidates,size_t candidateCount,const aiPersonality_t &opponent,
+                                  unsigned playerCount,unsigned firstSeed,unsigned games,unsigned threads) {
+    tuneMatch_t match;
+    match.candidates = candidates;
+    match.candidateCount = candidateCount;
+    match.opponent = &opponent;
+    match.playerCount = playerCount;
+    match.firstSeed = firstSeed;
+    match.games = games;
+    match.nextGame = 0;
+    vector<tuneScores_t> scores(threads,tuneScores_t(candidateCount));
+    vector<thread> workers;
+    for (unsigned t=1; t<threads; t++)
+        workers.push_back(thread(playTuneGames,&match,&scores[t]));
+    playTuneGames(&match,&scores[0]);
+    for (unsigned t=1; t<threads; t++) {
+        workers[t-1].join();
+        scores[0].merge(scores[t]);
+    }
+    return scores[0];
+}
+
+// Standard normal, by Box-Muller (the first uniform is kept off zero for the log).
+static double normalSample(rng_t &rng) {
+    double u = (rng.next() + 1.0) / 4294967297.0, v = rng.next() / 4294967296.0;
+    return sqrt(-2 * log(u)) * cos(6.283185307179586 * v);
+}
+
+static personality_t tunedPersonality(const vector<double> &x,const vector<double> &scale) {
+    personality_t p;
+    for (size_t i=0; i<NELEM(personalityParams); i++) {
+        int value = int(floor(x[i] * scale[i] + 0.5));
+        p.*personalityParams[i].value = max(personalityParams[i].low,min(personalityParams[i].high,value));
+    }
+    return p;
+}
+
+static void runTune(const batchOptions_t &options,const tuneOptions_t &tune) {
+    const size_t n = NELEM(personalityParams);
+    const personality_t &start = options.personalities[0]? options.personalities[0]->params : defaultPersonality;
+    unsigned players = options.playerCount;
+    unsigned games = (tune.games + players - 1) / players * players;
+    size_t lambda = tune.population? tune.population : 4 + size_t(3 * log(double(n)));
+    size_t mu = lambda / 2;
+    unsigned threads = options.threads < lambda * games? options.threads : unsigned(lambda * games);
+    
+    // the usual settings for a separable CMA-ES (Ros and Hansen, 2008): log-rank recombination weights,
+    // and learning rates for the step size and the diagonal covariance scaled by the number of settings.
+    vector<double> weights(mu);
+    double weightSum = 0, weightSquares = 0;
+    for (size_t j=0; j<mu; j++)
+        weightSum += weights[j] = log(mu + 0.5) - log(j + 1.0);
+    for (size_t j=0; j<mu; j++)
+        weightSquares += (weights[j] /= weightSum) * weights[j];
+    double muEff = 1 / weightSquares;
+    double cSigma = (muEff + 2) / (n + muEff + 5);
+    double dSigma = 1 + 2 * max(0.0,sqrt((muEff - 1) / (n + 1)) - 1) + cSigma;
+    double cC = 4.0 / (n + 4);
+    double c1 = 2 / ((n + 1.3) * (n + 1.3) + muEff) * (n + 2) / 3;
+    double cMu = min(1 - c1,2 * (muEff - 2 + 1 / muEff) / ((n + 2) * (n + 2) + muEff) * (n + 2) / 3);
+    double chiN = sqrt(double(n)) * (1 - 1 / (4.0 * n) + 1 / (21.0 * n * n));
+    
+    vector<double> scale(n), mean(n), variance(n,1.0), pathSigma(n), pathC(n);
+    for (size_t i=0; i<n; i++) {
+        int value = start.*personalityParams[i].value;
+        scale[i] = max(abs(value),4);
+        mean[i] = value / scale[i];
+    }
+    double sigma = 0.3;
+    
+    printf("Tuning %u settings: %u generations of %u, %u games each, %u players, seeds %u-%u, %u thread%s\n",
+           unsigned(n), tune.generations, unsigned(lambda), games, players, options.seed, options.seed + (tune.generations + 4) * games - 1, threads, threads>1?"s":"");
+    rng_t rng(options.seed);
+    vector<aiPersonality_t> candidates(lambda);
+    vector<vector<double>> z(lambda,vector<double>(n));
+    aiPersonality_t meanAi;
+    for (unsigned gen=0; gen<tune.generations; gen++) {
+        setPersonality(meanAi,tunedPersonality(mean,scale));
+        for (size_t k=0; k<lambda; k++) {
+            vector<double> x(n);
+            for (size_t i=0; i<n; i++) {
+                z[k][i] = normalSample(rng);
+                x[i] = mean[i] + sigma * sqrt(variance[i]) * z[k][i];
+            }
+            setPersonality(candidates[k],tunedPersonality(x,scale));
+        }
+        tuneScores_t scores = playTuneMatch(candidates.data(),lambda,meanAi,players,options.seed + gen * games,games,threads);
+        vector<size_t> order(lambda);
+        for (size_t k=0; k<lambda; k++)
+            order[k] = k;
+        stable_sort(order.begin(),order.end(),[&](size_t a,size_t b) { return scores.places[a] > scores.places[b]; });
+        
+        // move the mean by the weighted best steps, then update the evolution paths, the variances and the step size.
+        vector<double> zWeighted(n);
+        for (size_t j=0; j<mu; j++)
+            for (size_t i=0; i<n; i++)
+                zWeighted[i] += weights[j] * z[order[j]][i];
+        double pathNorm = 0;
+        for (size_t i=0; i<n; i++) {
+            pathSigma[i] = (1 - cSigma) * pathSigma[i] + sqrt(cSigma * (2 - cSigma) * muEff) * zWeighted[i];
+            pathNorm += pathSigma[i] * pathSigma[i];
+        }
+        pathNorm = sqrt(pathNorm);
+        bool steady = pathNorm / sqrt(1 - pow(1 - cSigma,2.0 * (gen + 1))) < (1.4 + 2.0 / (n + 1)) * chiN;
+        for (size_t i=0; i<n; i++) {
+            double yWeighted = sqrt(variance[i]) * zWeighted[i];
+            mean[i] += sigma * yWeighted;
+            pathC[i] = (1 - cC) * pathC[i] + (steady? sqrt(cC * (2 - cC) * muEff) * yWeighted : 0);
+            double rankMu = 0;
+            for (size_t j=0; j<mu; j++)
+                rankMu += weights[j] * variance[i] * z[order[j]][i] * z[order[j]][i];
+            variance[i] = (1 - c1 - cMu) * variance[i] + c1 * (pathC[i] * pathC[i] + (steady? 0 : cC * (2 - cC) * variance[i])) + cMu * rankMu;
+        }
+        sigma *= exp(cSigma / dSigma * (pathNorm / chiN - 1));
+        
+        uint64_t total = 0;
+        for (size_t k=0; k<lambda; k++)
+            total += scores.places[k];
+        double perGame = 1.0 / (games * (players - 1));
+        printf("Generation %u: best %.3f, average %.3f against the mean, step %.3f\n", gen+1, scores.places[order[0]] * perGame,
+               total * perGame / lambda, sigma);
+        fflush(stdout);
+    }
+    
+    // the final mean is the answer; play it against where we started, on seeds no generation saw.
+    personality_t tuned = tunedPersonality(mean,scale);
+    setPersonality(meanAi,tuned);
+    aiPersonality_t startAi;
+    setPersonality(startAi,start);
+    unsigned finalGames = games * 4;
+    threads = options.threads < finalGames? options.threads : finalGames;
+    tuneScores_t final = playTuneMatch(&meanAi,1,startAi,players,options.seed + tune.generations * games,finalGames,threads);
+    double score = double(final.places[0]) / (finalGames * (players - 1));
+    double scoreVariance = (double(final.squares[0]) / finalGames - score * score * (players - 1) * (players - 1)) / ((players - 1) * (players - 1));
+    double winRate = double(final.wins[0]) / finalGames;
+    printf("Against the starting personality over %u games: score %.3f +/- %.3f (0.5 is even), wins %.1f%% +/- %.1f%% (%.1f%% is even)\n",
+           finalGames, score, 1.96 * sqrt(max(scoreVariance,0.0) / finalGames), winRate * 100, 196 * sqrt(winRate * (1 - winRate) / finalGames), 100.0 / players);
+    // with how far the search was still reaching either side of each setting, as a guide to how settled it is
+    printf("%-24s %7s %7s %8s\n", "setting", "start", "tuned", "+/-");
+    for (size_t i=0; i<n; i++)
+        printf("%-24s %7d %7d %8.1f\n", personalityParams[i].name, start.*personalityParams[i].value, tuned.*personalityParams[i].value,
+               1.96 * sigma * sqrt(variance[i]) * scale[i]);
+    if (tune.outName) {
+        FILE *out = fopen(tune.outName,"w");
+        if (!out) {
+            printf("Can't write %s.\n", tune.outName);
+            return;
+        }
+        fprintf(out, "# tuned over %u generations of %u, %u players, seed %u\n", tune.generations, unsigned(lambda), players, options.seed);
+        writePersonality(out,tuned);
+        fclose(out);
+    }
+}
+
+/*
+    Fibers.  The game asks its brains for decisions from deep inside game_t::play, so a brain whose answer
+    comes from outside the program (an agent being trained, a human at the end of a connection) can't
+    return until it has one.  Rather than give every such game a thread, it runs on a fiber: a stack of its
+    own, which the brain leaves (yield) to wait and the fiber's owner goes back into (resume) once the answer
+    is in.  Switching is a few hundred nanoseconds and a waiting game costs only its stack.  There's nothing
+    like ucontext on Windows, so none of this is built there.
+    
+    A fiber has to be resumed on the thread that started it: narration and the event log are per thread.
+*/
+
+#if OUTPOST_FIBERS
+static const size_t FIBER_STACK_SIZE = 256 * 1024;
+
+class fiber_t {
+    ucontext_t context, caller;
+    char *stack;
+    void (*body)(void*);
+    void *argument;
+    bool running;
+    
+    // makecontext only passes ints.
+    static void enter(unsigned high,unsigned low) {
+        fiber_t &f = *(fiber_t*)uintptr_t((uint64_t(high) << 32) | low);
+        f.body(f.argument);
+        f.running = false;
+    }
+    fiber_t(const fiber_t&);
+    void operator=(const fiber_t&);
+public:
+    fiber_t() : stack(new char[FIBER_STACK_SIZE]), body(NULL), argument(NULL), running(false) { }
+    ~fiber_t() {
+        assert(!running);
+        delete[] stack;
+    }
+    
+    // true from start until body returns.
+    bool isRunning() const { return running; }
+    
+    // Runs body(argument) on the fiber until it yields or returns.
+    void start(void (*b)(void*),void *a) {
+        assert(!running);
+        body = b;
+        argument = a;
+        getcontext(&context);
+        context.uc_stack.ss_sp = stack;
+        context.uc_stack.ss_size = FIBER_STACK_SIZE;
+        context.uc_link = &caller;
+        uint64_t address = uintptr_t(this);
+        makecontext(&context,(void (*)())enter,2,unsigned(address >> 32),unsigned(address));
+        running = true;
+        swapcontext(&caller,&context);
+    }
+    
+    // Carries on from the last yield, until the next one or until body returns.
+    void resume() {
+        assert(running);
+        swapcontext(&caller,&context);
+    }
+    
+    // Only on the fiber: goes back to whoever started or last resumed it.
+    void yield() { swapcontext(&context,&caller); }
+};
+#endif
+
+/*
+    Learning environments.  vectorEnv_t holds any number of games, each with one seat played by whoever is
+    being trained (the agent) and the stock computer player in the rest, and steps them all at once.  Every
+    game runs until the agent has something to decide, then reports what the agent can see and the legal
+    answers (see legalActions), and the next step carries on with the agent's answers.  The agent decides
+    the same things a search does: auctions, bids, and buying factories, colonists and robots.  The stock
+    computer player's heuristics still pay for things and assign personnel, and decisions with only one
+    legal answer are made without asking.
+    
+    Each game runs on a fiber of its own so that it can stop in the middle of asking a brain
+    something, and always on the same thread of the pool, since narration and the event log are per thread.
+    When a game ends the agent gets 1 for winning and 0 otherwise, and the environment starts another game
+    right away, seeded with the last one's seed plus the number of environments; the observation that comes
+    with the reward is already from the new game.  The agent sits in the seat the seed picks (seed modulo
+    the number of players).
+*/
+
+#if OUTPOST_FIBERS
+// An observation is what a player in the agent's seat can see, as floats: for each player, starting with
+// the agent and going round the table (empty seats are zeros), factories, colonists and robots at each
+// (and unused), upgrades and cards of each type in hand, and then VPs, colonists, the colonist limit
+// (including era 3 factories), robots, the production limit, and the least and most the hand can be worth.
+static const size_t OBSERVATION_PER_PLAYER = PRODUCTION_COUNT + 2 * (PRODUCTION_COUNT + 1) + UPGRADE_COUNT + PRODUCTION_COUNT + 7;
+// Ahead of that, the decision (one-hot, then the decision point's which, limit and amount), the round, era
+// and number of players, the high bid and high bidder (counting round from the agent) during an auction,
+// how many of each upgrade are in the market and still to come, and the agent's own cards, slot by slot.
+static const size_t OBSERVATION_SIZE = DECIDE_COUNT + 3 + 5 + 2 * UPGRADE_COUNT + HAND_SLOTS + MAX_PLAYERS * OBSERVATION_PER_PLAYER;
+
+static void observe(const gameState_t &state,const decisionPoint_t &point,playerIndex_t seat,float *out) {
+    fill(out, out + OBSERVATION_SIZE, 0.0f);
+    out[point.decision] = 1;
+    out += DECIDE_COUNT;
+    *out++ = point.which;
+    *out++ = point.limit;
+    *out++ = point.amount;
+    const gameCursor_t &cursor = state.cursor;
+    *out++ = cursor.round;
+    *out++ = state.era;
+    *out++ = state.playerCount;
+    if (cursor.stage == TURN_BIDDING) {
+        out[0] = cursor.bid;
+        out[1] = (cursor.highBidder + state.playerCount - seat) % state.playerCount;
+    }
+    out += 2;
+    for (int i=DATA_LIBRARY; i<UPGRADE_COUNT; i++)
+        *out++ = state.currentMarketCounts[i];
+    for (int i=DATA_LIBRARY; i<UPGRADE_COUNT; i++)
+        *out++ = state.upgradeDrawPiles[i];
+    for (size_t s=0; s<HAND_SLOTS; s++)
+        *out++ = state.players[seat].hand.getCount(s);
+    for (playerIndex_t n=0; n<state.playerCount; n++) {
+        const playerState_t &p = state.players[(seat + n) % state.playerCount];
+        for (int i=ORE; i<PRODUCTION_COUNT; i++)
+            *out++ = p.factories[i];
+        for (int i=ORE; i<=UNUSED; i++)
+            *out++ = p.mannedByColonists[i];
+        for (int i=ORE; i<=UNUSED; i++)
+            *out++ = p.mannedByRobots[i];
+        for (int i=DATA_LIBRARY; i<UPGRADE_COUNT; i++)
+            *out++ = p.upgrades[i];
+        for (int i=ORE; i<PRODUCTION_COUNT; i++)
+            *out++ = p.hand.countOf(productionEnum_t(i));
+        money_t least = p.totalCredits, most = p.totalCredits;
+        if (n)
+            p.getExpectedMoneyInHand(least,most);
+        *out++ = p.victoryPoints;
+        *out++ = p.colonists;
+        *out++ = p.colonistLimit + p.extraColonistLimit;
+        *out++ = p.robots;
+        *out++ = p.productionLimit;
+        *out++ = least;
+        *out++ = most;
+    }
+}
+
+// One of vectorEnv_t's games and the fiber it runs on.
+struct environment_t {
+    fiber_t fiber;              // running while the game is under way
+    game_t *game;
+    playerIndex_t seat;
+    unsigned seed;
+    bool finishing;             // nobody's listening any more, so the stock computer player decides for the agent
+    bool illegal;               // the agent's last answer wasn't legal, so the stock computer player decided instead
+    amt_t rounds;               // how the game ended; see game_t::play
+    gameState_t state;          // as of the decision being asked
+    decisionPoint_t point;
+    vector<action_t> legal;     // every legal answer to point; grows as needed
+    size_t legalCount;
+    action_t answer;
+};
+
+// Asks the agent, by stopping the game until the environment is next stepped.
+class agentBrain_t: public computerBrain_t {
+    environment_t &env;
+    
+    // false if the stock computer player should decide after all.
+    bool decide(action_t &answer,decisionEnum_t decision,size_t which = 0,money_t amount = 0) {
+        if (env.finishing)
+            return false;
+        game.saveState(env.state);
+        ask(env.point,decision,env.seat,which,0,amount);
+        env.legalCount = legalActions(env.state,env.point,&env.legal[0],env.legal.size());
+        if (env.legalCount > env.legal.size()) {
+            env.legal.resize(env.legalCount);
+            legalActions(env.state,env.point,&env.legal[0],env.legal.size());
+        }
+        if (env.legalCount == 1) {
+            answer = env.legal[0];
+            return true;
+        }
+        env.fiber.yield();
+        if (env.finishing || env.illegal)
+            return false;
+        answer = env.answer;
+        return true;
+    }
+public:
+    agentBrain_t(const game_t &theGame,environment_t &e) : computerBrain_t("*Agent",theGame), env(e) { }
+    
+    cardIndex_t pickCardToAuction(hand_t &hand,vector<upgradeEnum_t> &upgradeMarket,money_t &bid) {
+        action_t a;
+        if (!decide(a,DECIDE_AUCTION))
+            return computerBrain_t::pickCardToAuction(hand,upgradeMarket,bid);
+        bid = a.amount;
+        return a.which;
+    }
+    money_t raiseOrPass(player_t &highBidder,hand_t &hand,upgradeEnum_t upgrade,money_t minBid) {
+        action_t a;
+        return decide(a,DECIDE_BID,upgrade,minBid)? a.amount : computerBrain_t::raiseOrPass(highBidder,hand,upgrade,minBid);
+    }
+    amt_t purchaseFactories(const vector<byte_t> &maxByType,productionEnum_t &whichFactory) {
+        action_t a;
+        if (!decide(a,DECIDE_FACTORIES))
+            return computerBrain_t::purchaseFactories(maxByType,whichFactory);
+        whichFactory = productionEnum_t(a.which);
+        return a.amount;
+    }
+    amt_t purchaseColonists(money_t perColonist,amt_t maxAllowed) {
+        action_t a;
+        return decide(a,DECIDE_COLONISTS)? a.amount : computerBrain_t::purchaseColonists(perColonist,maxAllowed);
+    }
+    amt_t purchaseRobots(money_t perRobot,amt_t maxAllowed,amt_t maxUsable) {
+        action_t a;
+        return decide(a,DECIDE_ROBOTS)? a.amount : computerBrain_t::purchaseRobots(perRobot,maxAllowed,maxUsable);
+    }
+};
+
+static void runEnvironmentGame(void *e) {
+    environment_t &env = *(environment_t*)e;
+    env.rounds = env.game->play(maxBatchRounds);
+}
+
+// Where vectorEnv_t reports on its games, environment after environment; all of it belongs to the caller.
+struct envBuffers_t {
+    float *observations;        // OBSERVATION_SIZE each
+    action_t *legal;            // legalCapacity each: the first of the legal actions
+    uint32_t *legalCounts;      // how many legal actions there are, which can be more than legalCapacity
+    float *rewards;
+    byte_t *dones;              // a game ended during the last step
+};
+
+class vectorEnv_t {
+    vector<environment_t*> envs;
+    playerIndex_t playerCount;
+    size_t legalCapacity;
+    
+    // thread t always runs the environments from envs.size() * t / threadCount on; the caller's thread is thread 0.
+    enum job_t { JOB_RESET, JOB_STEP, JOB_FINISH };
+    unsigned threadCount;
+    vector<thread> workers;
+    mutex lock;
+    condition_variable wake, finished;
+    unsigned generation, busy;
+    bool stopping;
+    job_t job;
+    const unsigned *seeds;
+    const action_t *actions;
+    envBuffers_t out;
+    atomic<unsigned> illegalAnswers;
+    
+    // Plays out the game on the fiber, if there is one, with the stock computer player in the agent's seat too.
+    void finishGame(environment_t &env) {
+        env.finishing = true;
+        while (env.fiber.isRunning())
+            env.fiber.resume();
+        env.finishing = false;
+        delete env.game;
+        env.game = NULL;
+    }
+    
+    // Starts a game and runs it to the agent's first decision.
+    void startGame(environment_t &env,unsigned seed) {
+        finishGame(env);
+        env.seed = seed;
+        env.seat = seed % playerCount;
+        env.game = new game_t(playerCount,seed);
+        for (playerIndex_t p=0; p<playerCount; p++)
+            env.game->setPlayerBrain(p,p == env.seat? *new agentBrain_t(*env.game,env) : *new computerBrain_t("*Computer",*env.game));
+        env.illegal = false;
+        env.fiber.start(runEnvironmentGame,&env);
+    }
+    
+    void runEnvironment(size_t e) {
+        environment_t &env = *envs[e];
+        if (job == JOB_FINISH) {
+            finishGame(env);
+            return;
+        }
+        float reward = 0;
+        byte_t done = 0;
+        if (job == JOB_RESET)
+            startGame(env,seeds[e]);
+        else {
+            env.answer = actions[e];
+            env.illegal = find(env.legal.begin(), env.legal.begin() + env.legalCount, env.answer) == env.legal.begin() + env.legalCount;
+            if (env.illegal)
+                illegalAnswers++;
+            env.fiber.resume();
+        }
+        while (!env.fiber.isRunning()) {
+            reward = env.rounds && env.game->getPlayerAtRank(0) == env.seat? 1 : 0;
+            done = 1;
+            startGame(env,env.seed + unsigned(envs.size()));
+        }
+        out.rewards[e] = reward;
+        out.dones[e] = done;
+        observe(env.state,env.point,env.seat,out.observations + e * OBSERVATION_SIZE);
+        size_t kept = min(env.legalCount,legalCapacity);
+        copy(env.legal.begin(), env.legal.begin() + kept, out.legal + e * legalCapacity);
+        out.legalCounts[e] = uint32_t(env.legalCount);
+    }
+    
+    void runSlice(unsigned t) {
+        for (size_t e=envs.size() * t / threadCount; e<envs.size() * (t + 1) / threadCount; e++)
+            runEnvironment(e);
+    }
+    
+    static void work(vectorEnv_t *v,unsigned t) {
+        table.setSink(NULL);
+        unique_lock<mutex> hold(v->lock);
+        for (unsigned seen=0;;) {
+            while (!v->stopping && v->generation == seen)
+                v->wake.wait(hold);
+            if (v->stopping)
+                return;
+            seen = v->generation;
+            hold.unlock();
+            v->runSlice(t);
+            hold.lock();
+            if (!--v->busy)
+                v->finished.notify_one();
+        }
+    }
+    
+    void runJob(job_t j) {
+        // the games are neither narrated nor logged.
+        outputSink_t *sink = table.getSink();
+        table.setSink(NULL);
+        bool recording = events.isRecording();
+        events.setRecording(false);
+        {
+            lock_guard<mutex> hold(lock);
+            job = j;
+            busy = unsigned(workers.size());
+            generation++;
+        }
+        wake.notify_all();
+        runSlice(0);
+        {
+            unique_lock<mutex> hold(lock);
+            while (busy)
+                finished.wait(hold);
+        }
+        table.setSink(sink);
+        events.setRecording(recording);
+    }
+public:
+    vectorEnv_t(size_t count,playerIndex_t players,unsigned threads,size_t capacity) :
+        playerCount(players), legalCapacity(capacity), threadCount(threads? threads : 1), generation(0), busy(0), stopping(false),
+        seeds(NULL), actions(NULL), illegalAnswers(0) {
+        for (size_t e=0; e<count; e++) {
+            environment_t *env = new environment_t;
+            env->game = NULL;
+            env->finishing = env->illegal = false;
+            env->legal.resize(64);
+            env->legalCount = 0;
+            envs.push_back(env);
+        }
+        for (unsigned t=1; t<threadCount; t++)
+            workers.push_back(thread(work,this,t));
+    }
+    ~vectorEnv_t() {
+        runJob(JOB_FINISH);
+        {
+            lock_guard<mutex> hold(lock);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (size_t t=0; t<workers.size(); t++)
+            workers[t].join();
+        for (size_t e=0; e<envs.size(); e++)
+            delete envs[e];
+    }
+    
+    size_t size() const { return envs.size(); }
+    
+    // Starts a game in each environment with the given seeds (one per environment).
+    void reset(const unsigned *s,const envBuffers_t &buffers) {
+        seeds = s;
+        out = buffers;
+        runJob(JOB_RESET);
+    }
+    
+    // Answers each environment's decision with one of its legal actions (one per environment) and plays on to the next.
+    // An answer that isn't legal is made by the stock computer player instead; returns how many of those there have been.
+    unsigned step(const action_t *a,const envBuffers_t &buffers) {
+        actions = a;
+        out = buffers;
+        runJob(JOB_STEP);
+        return illegalAnswers;
+    }
+};
+
+// Random agents, to see how fast the environments go.
+static void runEnvironments(const batchOptions_t &options,size_t count) {
+    static const size_t legalCapacity = 256;
+    vectorEnv_t env(count,options.playerCount,options.threads,legalCapacity);
+    vector<float> observations(count * OBSERVATION_SIZE), rewards(count);
+    vector<action_t> legal(count * legalCapacity), actions(count);
+    vector<uint32_t> legalCounts(count);
+    vector<byte_t> dones(count);
+    envBuffers_t out = { &observations[0], &legal[0], &legalCounts[0], &rewards[0], &dones[0] };
+    vector<unsigned> seeds(count);
+    for (size_t e=0; e<count; e++)
+        seeds[e] = options.seed + unsigned(e);
+    rng_t rng(options.seed);
+    
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    env.reset(&seeds[0],out);
+    unsigned games = 0, wins = 0, illegal = 0;
+    unsigned long long steps = 0;
+    while (games < options.games) {
+        for (size_t e=0; e<count; e++)
+            actions[e] = legal[e * legalCapacity + rng.below(uint32_t(min<size_t>(legalCounts[e],legalCapacity)))];
+        illegal = env.step(&actions[0],out);
+        steps += count;
+        for (size_t e=0; e<count; e++)
+            if (dones[e]) {
+                games++;
+                wins += rewards[e] > 0;
+            }
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    printf("%zu environments, %u games, %llu steps in %.2f seconds: %.0f steps a second.\n", count, games, steps, seconds, steps / seconds);
+    printf("The random agent won %.1f%% of its games (an even share is %.1f%%)%s.\n", 100.0 * wins / games, 100.0 / options.playerCount,
+           illegal? "; some of its answers were illegal!" : "");
+}
+#endif
+
+/*
+    Hosting games.  A human's brain (playerBrain_t) waits on its input source for every answer, which at the
+    terminal means one game holds the whole program until its player types something.  gameHost_t runs
+    each of its games on a fiber instead, with an input source per human seat that, when it has no line to
+    hand, stops the game until one is given to the host (see answer).  Nothing else about a game changes, so
+    humans and computer players mix as they always have, and one thread can keep any number of games
+    waiting on their players at once, for the price of a stack each.
+    
+    Narration is per thread, so each game has its own stream, swapped in while the game runs; what a game
+    says collects until whoever is passing on its players' answers takes it (see takeOutput).  Games are
+    neither logged nor recorded.  Answers given ahead of the question wait their turn, as typing ahead at
+    the terminal does.  Closing a game that isn't over answers everything else with an empty line, which
+    always takes the default, so the game plays out and everything it holds is freed; a player who leaves
+    is treated the same way while everyone else plays on.
+*/
+
+#if OUTPOST_FIBERS
+struct hostedGame_t;
+
+// One human seat's answers.
+class hostedSeat_t: public inputSource_t {
+    hostedGame_t &game;
+    playerIndex_t seat;
+public:
+    deque<string> lines;
+    bool gone;                  // the player has left; everything they haven't answered takes the default
+    decisionEnum_t asking;      // what the player's being asked, if anything
+    
+    hostedSeat_t(hostedGame_t &g,playerIndex_t s) : game(g), seat(s), gone(false), asking(DECIDE_NOTHING) { }
+    bool readLine(string &line);
+    
+    // Whether a game waiting on this seat can be checkpointed.  The questions that can be asked again from the
+    // top when the game picks up, because nothing has changed since they were first asked, are the searched
+    // ones and personnel (where moves already made are simply redone).  Megaproduction and discards come
+    // between turns, and a payment may be half made.
+    bool isResumable() const { return (asking >= DECIDE_AUCTION && asking <= DECIDE_ROBOTS) || asking == DECIDE_PERSONNEL; }
+};
+
+// A person at a hosted seat, keeping track of what they're being asked.
+class hostedPlayerBrain_t: public playerBrain_t {
+    decisionEnum_t &asking;
+    
+    // some questions are asked while answering another, eg the opening bid for an auction.
+    struct ask_t {
+        decisionEnum_t &asking, outer;
+        ask_t(decisionEnum_t &a,decisionEnum_t d) : asking(a), outer(a) { asking = d; }
+        ~ask_t() { asking = outer; }
+    };
+public:
+    hostedPlayerBrain_t(string name,hostedSeat_t &seat) : playerBrain_t(name,seat), asking(seat.asking) { }
+    
+    amt_t wantMega(productionEnum_t t,amt_t maxMega) {
+        ask_t ask(asking,DECIDE_MEGA);
+        return playerBrain_t::wantMega(t,maxMega);
+    }
+    cardIndex_t pickDiscard(hand_t &hand) {
+        ask_t ask(asking,DECIDE_DISCARD);
+        return playerBrain_t::pickDiscard(hand);
+    }
+    cardIndex_t pickCardToAuction(hand_t &hand,vector<upgradeEnum_t> &upgradeMarket,money_t &bid) {
+        ask_t ask(asking,DECIDE_AUCTION);
+        return playerBrain_t::pickCardToAuction(hand,upgradeMarket,bid);
+    }
+    money_t raiseOrPass(player_t &highBidder,hand_t &hand,upgradeEnum_t upgrade,money_t minBid) {
+        ask_t ask(asking,DECIDE_BID);
+        return playerBrain_t::raiseOrPass(highBidder,hand,upgrade,minBid);
+    }
+    money_t payFor(money_t cost,hand_t &hand,bank_t &bank,amt_t minimumResearchCards) {
+        ask_t ask(asking,DECIDE_PAYMENT);
+        return playerBrain_t::payFor(cost,hand,bank,minimumResearchCards);
+    }
+    amt_t purchaseFactories(const vector<byte_t> &maxByType,productionEnum_t &whichFactory) {
+        ask_t ask(asking,DECIDE_FACTORIES);
+        return playerBrain_t::purchaseFactories(maxByType,whichFactory);
+    }
+    amt_t purchaseColonists(money_t perColonist,amt_t maxAllowed) {
+        ask_t ask(asking,DECIDE_COLONISTS);
+        return playerBrain_t::purchaseColonists(perColonist,maxAllowed);
+    }
+    amt_t purchaseRobots(money_t perRobot,amt_t maxAllowed,amt_t maxUsable) {
+        ask_t ask(asking,DECIDE_ROBOTS);
+        return playerBrain_t::purchaseRobots(perRobot,maxAllowed,maxUsable);
+    }
+    void assignPersonnel() {
+        ask_t ask(asking,DECIDE_PERSONNEL);
+        playerBrain_t::assignPersonnel();
+    }
+};
+
+struct hostedGame_t {
+    fiber_t fiber;              // running until the game is over
+    game_t game;
+    mystream_t narration;       // in table while the game runs
+    stringSink_t said;          // everything narrated since takeOutput
+    vector<hostedSeat_t*> seats;    // NULL for computer players
+    playerIndex_t waitingOn;    // seat that's been asked something, or NO_PLAYER
+    bool closing;
+    bool resuming;              // the game was restored from a checkpoint
+    amt_t rounds;               // see game_t::play
+    
+    hostedGame_t(playerIndex_t playerCount,unsigned seed) :
+        game(playerCount,seed), seats(playerCount), waitingOn(NO_PLAYER), closing(false), resuming(false), rounds(0) {
+        narration.setSink(&said);
+    }
+    ~hostedGame_t() {
+        for (size_t i=0; i<seats.size(); i++)
+            delete seats[i];
+    }
+    
+    static void run(void *g) {
+        hostedGame_t &hosted = *(hostedGame_t*)g;
+        hosted.rounds = hosted.resuming? hosted.game.resume() : hosted.game.play();
+    }
+    
+    // Runs the game until it waits on somebody or is over.
+    void carryOn() {
+        swap(table,narration);
+        bool recording = events.isRecording();
+        events.setRecording(false);
+        if (fiber.isRunning())
+            fiber.resume();
+        else
+            fiber.start(run,this);
+        events.setRecording(recording);
+        swap(table,narration);
+    }
+};
+
+bool hostedSeat_t::readLine(string &line) {
+    while (lines.empty() && !gone && !game.closing) {
+        game.waitingOn = seat;
+        game.fiber.yield();
+    }
+    game.waitingOn = NO_PLAYER;
+    if (lines.empty())
+        return false;
+    line.swap(lines.front());
+    lines.pop_front();
+    return true;
+}
+
+class gameHost_t {
+    vector<hostedGame_t*> games;    // by id; NULL once closed
+    vector<size_t> freeIds;
+    
+    hostedGame_t &get(size_t id) const {
+        assert(id < games.size() && games[id]);
+        return *games[id];
+    }
+    
+    // Seats a human in each seat with a bit in humans, and a computer player in the rest.
+    size_t add(hostedGame_t *hosted,const vector<string> &names,uint32_t humans) {
+        for (playerIndex_t i=0; i<names.size(); i++) {
+            brain_t *brain;
+            if (humans >> i & 1) {
+                hosted->seats[i] = new hostedSeat_t(*hosted,i);
+                brain = new hostedPlayerBrain_t(names[i],*hosted->seats[i]);
+            }
+            else
+                brain = new computerBrain_t(names[i],hosted->game);
+            hosted->game.setPlayerBrain(i,*brain);
+        }
+        size_t id = games.size();
+        if (freeIds.size()) {
+            id = freeIds.back();
+            freeIds.pop_back();
+            games[id] = hosted;
+        }
+        else
+            games.push_back(hosted);
+        return id;
+    }
+public:
+    ~gameHost_t() {
+        for (size_t id=0; id<games.size(); id++)
+            if (games[id])
+                close(id);
+    }
+    
+    // Starts a game with a human in each seat that has a name (and a computer player in the rest), and runs
+    // it until it waits on one of the humans; returns the game's id, which is reused once the game is closed.
+    size_t start(unsigned seed,const vector<string> &humanNames) {
+        vector<string> names(humanNames);
+        uint32_t humans = 0;
+        for (playerIndex_t i=0; i<names.size(); i++)
+            if (names[i].size())
+                humans |= 1 << i;
+            else
+                names[i] = "*Computer " + to_string(i + 1);
+        hostedGame_t *hosted = new hostedGame_t(playerIndex_t(names.size()),seed);
+        size_t id = add(hosted,names,humans);
+        hosted->carryOn();
+        return id;
+    }
+    
+    // Saves a game that's waiting on one of its humans, as long as it can be picked up again from the question
+    // they're being asked (see hostedSeat_t::isResumable); if not, try again after they've answered.
+    bool checkpoint(size_t id,checkpoint_t &out) const {
+        const hostedGame_t &hosted = get(id);
+        if (hosted.waitingOn == NO_PLAYER || !hosted.seats[hosted.waitingOn]->isResumable())
+            return false;
+        uint16_t humans = 0;
+        for (playerIndex_t i=0; i<hosted.seats.size(); i++)
+            if (hosted.seats[i])
+                humans |= 1 << i;
+        out.save(hosted.game,humans);
+        return true;
+    }
+    
+    // Picks up a game from a checkpoint, same as start.  Whoever was being asked something is asked again.
+    size_t restore(const checkpoint_t &checkpoint) {
+        vector<string> names(checkpoint.state.playerCount);
+        for (playerIndex_t i=0; i<names.size(); i++)
+            names[i] = checkpoint.getName(i);
+        hostedGame_t *hosted = new hostedGame_t(playerIndex_t(names.size()),0);
+        size_t id = add(hosted,names,checkpoint.humans);
+        hosted->game.restoreState(checkpoint.state);
+        hosted->resuming = true;
+        hosted->carryOn();
+        return id;
+    }
+    
+    // The seat the game is waiting on, or NO_PLAYER if it's over.
+    playerIndex_t waitingOn(size_t id) const { return get(id).waitingOn; }
+    bool isOver(size_t id) const { return !get(id).fiber.isRunning(); }
+    // as game_t::play returns it, once the game is over.
+    amt_t getRounds(size_t id) const { return get(id).rounds; }
+    const game_t &getGame(size_t id) const { return get(id).game; }
+    
+    // Gives a human seat its next answer (a line without its newline), and if the game was waiting on that
+    // seat, runs it until it waits on somebody again.  Answers for a computer player's seat are ignored.
+    void answer(size_t id,playerIndex_t seat,const string &line) {
+        hostedGame_t &hosted = get(id);
+        if (seat >= hosted.seats.size() || !hosted.seats[seat])
+            return;
+        hosted.seats[seat]->lines.push_back(line);
+        if (hosted.waitingOn == seat)
+            hosted.carryOn();
+    }
+    
+    // From now on the seat takes the default for everything it's asked, as if it had been closed.
+    void leave(size_t id,playerIndex_t seat) {
+        hostedGame_t &hosted = get(id);
+        if (seat >= hosted.seats.size() || !hosted.seats[seat])
+            return;
+        hosted.seats[seat]->gone = true;
+        if (hosted.waitingOn == seat)
+            hosted.carryOn();
+    }
+    
+    // Everything the game has narrated since last asked.
+    string takeOutput(size_t id) {
+        string text;
+        text.swap(get(id).said.text);
+        return text;
+    }
+    
+    // Plays out the rest of the game with default answers if it isn't over, and frees it.
+    void close(size_t id) {
+        hostedGame_t &hosted = get(id);
+        hosted.closing = true;
+        while (hosted.fiber.isRunning())
+            hosted.carryOn();
+        delete &hosted;
+        games[id] = NULL;
+        freeIds.push_back(id);
+    }
+};
+
+// What a scripted "player" picks its answers from.
+static const char *scriptedReplies[] = { "", "", "0", "1", "2", "3", "5", "c", "r", "y" };
+
+// Takes down every game waiting at a question it can be picked up from, as if the host were restarting, and
+// brings it back from a checkpoint file.
+static bool restartHost(gameHost_t &host,vector<size_t> &live,const char *checkpointName) {
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    vector<checkpoint_t> checkpoints(live.size());
+    vector<size_t> saved;
+    for (size_t i=0; i<live.size(); i++)
+        if (host.checkpoint(live[i],checkpoints[saved.size()]))
+            saved.push_back(i);
+    fileSink_t *file = openLogFile(checkpointName);
+    if (!file)
+        return false;
+    saveCheckpoints(*file,&checkpoints[0],saved.size());
+    delete file;
+    double saving = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    
+    for (size_t i=0; i<saved.size(); i++)
+        host.close(live[saved[i]]);
+    start = chrono::steady_clock::now();
+    if (!loadCheckpoints(checkpointName,checkpoints))
+        return false;
+    double loading = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    start = chrono::steady_clock::now();
+    for (size_t i=0; i<saved.size(); i++)
+        live[saved[i]] = host.restore(checkpoints[i]);
+    double restoring = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    printf("Checkpointed %zu of %zu games (%zu bytes each) in %.1f ms, read them back in %.1f ms, and had them waiting on their players again in %.1f ms.\n",
+           saved.size(), live.size(), sizeof(checkpoint_t), saving * 1000, loading * 1000, restoring * 1000);
+    return true;
+}
+
+// Plays many games at once on one thread, each with one human seat whose "player" answers every question
+// with something picked at random from a few plausible replies, to see how many games a host can juggle.
+static void runHost(const batchOptions_t &options,size_t concurrent,const char *checkpointName) {
+    rng_t rng(options.seed);
+    gameHost_t host;
+    vector<size_t> live;
+    unsigned started = 0, finished = 0;
+    unsigned long long answers = 0, narrated = 0;
+    
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    while (live.size() < concurrent && started < options.games) {
+        vector<string> names(options.playerCount);
+        names[started % options.playerCount] = "Player";
+        live.push_back(host.start(options.seed + started++,names));
+    }
+    for (unsigned pass=1; live.size(); pass++) {
+        // by now most games are well under way.
+        if (checkpointName && pass == 100 && !restartHost(host,live,checkpointName))
+            return;
+        for (size_t i=0; i<live.size(); ) {
+            size_t id = live[i];
+            narrated += host.takeOutput(id).size();
+            if (!host.isOver(id)) {
+                host.answer(id,host.waitingOn(id),scriptedReplies[rng.below(NELEM(scriptedReplies))]);
+                answers++;
+                i++;
+                continue;
+            }
+            host.close(id);
+            finished++;
+            if (started < options.games) {
+                vector<string> names(options.playerCount);
+                names[started % options.playerCount] = "Player";
+                live[i++] = host.start(options.seed + started++,names);
+            }
+            else {
+                live[i] = live.back();
+                live.pop_back();
+            }
+        }
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    printf("%u games, up to %zu at once on one thread: %llu answers in %.2f seconds (%.0f a second), %.1f MB narrated.\n",
+           finished, concurrent, answers, seconds, answers / seconds, narrated / 1e6);
+}
+#endif
+
+/*
+    The game server.  --serve listens on a local socket and hosts as many games at once as people care to
+    start, each with any mix of human and computer players; a connection is one human player.  It speaks
+    lines both ways.  Before a game, a connection sends
+    
+        new <players> <humans> [<name>]    starts a game; the first <humans> seats are for people, and
+                                            this connection takes the first of them
+        join <game> [<name>]               takes the next free human seat in a game that's waiting for them
+        quit
+    
+    and once every human seat is taken and the game is under way, every line it sends is an answer, just as
+    typed at the terminal.  The server's lines all start with what they are:
+    
+        = <game> <seat>                     you're in that game, in that seat (from 0)
+        : <text>                            the game's narration, which every human in the game sees
+        ?                                   your turn to answer (the question is the narration just before)
+        . <rounds> <seat>                   the game is over, won by that seat; the connection can start again
+        ! <message>                         something was wrong with the last line
+    
+    The network thread does nothing but move bytes and parse lines, waiting on every connection at once
+    with epoll (poll where there's no epoll).  The games belong to --threads workers, each hosting its
+    share on fibers with a gameHost_t, so the computer players' thinking never holds up anyone's I/O.  Each
+    game stays with the worker it started on; the network thread hands over answers and players leaving,
+    and the worker hands back what the game said and whom it's waiting on, each through a queue.  A player
+    who disconnects mid-game takes the default from then on (see gameHost_t::leave).  A connection's
+    buffers are kept, capacity and all, for whichever connection gets its descriptor next.
+    
+    --bots plays scripted clients against a server, to try it out.
+*/
+
+#if OUTPOST_FIBERS
+// "1234" is that TCP port on the loopback interface; anything else is the path of a Unix socket.
+// Returns the socket, or -1 after saying why not.
+static int openSocket(const char *address,bool listening) {
+    bool isPort = *address && strspn(address, "0123456789") == strlen(address);
+    int fd = socket(isPort? AF_INET : AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        printf("Cannot create a socket: %s.\n", strerror(errno));
+        return -1;
+    }
+    int result;
+    if (isPort) {
+        sockaddr_in where;
+        memset(&where, 0, sizeof(where));
+        where.sin_family = AF_INET;
+        where.sin_port = htons(uint16_t(atoi(address)));
+        where.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        int on = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        // answers are small and each waits on the last, so don't hold them back to fill packets.
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        result = listening? ::bind(fd, (sockaddr*)&where, sizeof(where)) : connect(fd, (sockaddr*)&where, sizeof(where));
+    }
+    else {
+        sockaddr_un where;
+        memset(&where, 0, sizeof(where));
+        where.sun_family = AF_UNIX;
+        if (strlen(address) >= sizeof(where.sun_path)) {
+            printf("Socket path %s is too long.\n", address);
+            close(fd);
+            return -1;
+        }
+        strcpy(where.sun_path, address);
+        if (listening)
+            unlink(address);
+        result = listening? ::bind(fd, (sockaddr*)&where, sizeof(where)) : connect(fd, (sockaddr*)&where, sizeof(where));
+    }
+    if (result == 0 && listening)
+        result = listen(fd, 128);
+    if (result) {
+        printf("Cannot %s %s: %s.\n", listening? "listen on" : "connect to", address, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// The descriptors the server is waiting on, and which of them have something to read or room to write.
+// Handlers may close descriptors (and accept new ones, which can reuse their numbers) while wait is going
+// through what's ready, so anything removed meanwhile is skipped for the rest of that wait.
+class waitSet_t {
+    vector<int> removed;        // since the current wait began
+    
+    bool wasRemoved(int fd) const { return std::find(removed.begin(), removed.end(), fd) != removed.end(); }
+#ifdef __linux__
+    int epoll;
+    vector<epoll_event> ready;
+    
+    void control(int op,int fd,bool writing) {
+        epoll_event e;
+        e.events = uint32_t(EPOLLIN) | (writing? uint32_t(EPOLLOUT) : 0);
+        e.data.fd = fd;
+        epoll_ctl(epoll, op, fd, &e);
+    }
+public:
+    waitSet_t() : epoll(epoll_create1(0)), ready(256) { }
+    ~waitSet_t() { close(epoll); }
+    void add(int fd) { control(EPOLL_CTL_ADD,fd,false); }
+    void remove(int fd) { 
+        control(EPOLL_CTL_DEL,fd,false); 
+        removed.push_back(fd);
+    }
+    void setWriting(int fd,bool writing) { control(EPOLL_CTL_MOD,fd,writing); }
+    
+    // Waits until something's ready, then calls handle(fd,readable,writable) for each.
+    template <class handler_t> void wait(handler_t handle) {
+        removed.clear();
+        int count = epoll_wait(epoll, &ready[0], int(ready.size()), -1);
+        for (int i=0; i<count; i++)
+            if (!wasRemoved(ready[i].data.fd))
+                handle(ready[i].data.fd, (ready[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) != 0, (ready[i].events & EPOLLOUT) != 0);
+        removed.clear();
+    }
+#else
+    vector<pollfd> fds, ready;
+    bool waiting;
+    
+    pollfd *find(int fd) {
+        for (size_t i=0; i<fds.size(); i++)
+            if (fds[i].fd == fd)
+                return &fds[i];
+        return NULL;
+    }
+public:
+    waitSet_t() : waiting(false) { }
+    void add(int fd) {
+        pollfd p = { fd, POLLIN, 0 };
+        fds.push_back(p);
+    }
+    void remove(int fd) {
+        pollfd *p = find(fd);
+        if (!p)
+            return;
+        // during a wait, just blank it out (poll skips negative descriptors); wait tidies up when it's done.
+        if (waiting) {
+            p->fd = -1;
+            removed.push_back(fd);
+        }
+        else {
+            *p = fds.back();
+            fds.pop_back();
+        }
+    }
+    void setWriting(int fd,bool writing) { 
+        if (pollfd *p = find(fd))
+            p->events = POLLIN | (writing? POLLOUT : 0); 
+    }
+    
+    // Waits until something's ready, then calls handle(fd,readable,writable) for each.
+    template <class handler_t> void wait(handler_t handle) {
+        if (poll(&fds[0], fds.size(), -1) <= 0)
+            return;
+        // handlers add descriptors too, so work from a copy.
+        ready = fds;
+        waiting = true;
+        for (size_t i=0; i<ready.size(); i++)
+            if (ready[i].revents && !wasRemoved(ready[i].fd))
+                handle(ready[i].fd, (ready[i].revents & (POLLIN | POLLHUP | POLLERR)) != 0, (ready[i].revents & POLLOUT) != 0);
+        waiting = false;
+        for (size_t i=0; i<removed.size(); i++)
+            remove(-1);
+        removed.clear();
+    }
+#endif
+};
+
+static const size_t NO_GAME = size_t(-1);
+static const size_t MAX_LINE = 4096;        // longer than any answer; a connection sending more without a newline is dropped
+
+// What the network thread asks a worker to do with one of its games; games are known by the server's id for them.
+struct serverRequest_t {
+    enum kind_t { START, ANSWER, LEAVE } kind;
+    size_t game;
+    playerIndex_t seat;
+    unsigned seed;              // START
+    vector<string> names;       // START: one per seat, empty for computer players
+    string line;                // ANSWER
+};
+
+// And what the worker has to say about it afterwards.
+struct serverReply_t {
+    size_t game;
+    string text;                // narration
+    playerIndex_t waitingOn;    // seat, or NO_PLAYER
+    bool over;
+    amt_t rounds;
+    playerIndex_t winner;
+};
+
+class gameServer_t;
+
+// Hosts a share of the games on a thread of its own.
+class serverWorker_t {
+    gameServer_t &server;
+    mutex lock;
+    condition_variable wake;
+    deque<serverRequest_t> requests;
+    bool stopping;
+    thread runner;
+    
+    void run();
+public:
+    serverWorker_t(gameServer_t &s) : server(s), stopping(false), runner(&serverWorker_t::run,this) { }
+    ~serverWorker_t() {
+        {
+            lock_guard<mutex> hold(lock);
+            stopping = true;
+        }
+        wake.notify_one();
+        runner.join();
+    }
+    void post(serverRequest_t &request) {
+        {
+            lock_guard<mutex> hold(lock);
+            requests.push_back(serverRequest_t());
+            swap(requests.back(),request);
+        }
+        wake.notify_one();
+    }
+};
+
+class gameServer_t {
+    // One connection.
+    struct session_t {
+        bool open, writing;     // writing: waiting for room to write the rest of out
+        string in, out;         // read but not yet a whole line; not yet written
+        size_t game;            // or NO_GAME
+        playerIndex_t seat;
+    };
+    // One game, as the network thread sees it.
+    struct serverGame_t {
+        bool inUse, started;
+        playerIndex_t humans;
+        vector<string> names;       // one per seat, empty for computer players
+        vector<int> sessions;       // one per human seat; -1 while it's free or after its player has left
+        serverWorker_t *worker;
+    };
+    
+    int listener, wakeRead, wakeWrite;
+    waitSet_t waits;
+    vector<session_t> sessions;     // by descriptor
+    vector<serverGame_t> games;
+    vector<size_t> freeGames;
+    vector<serverWorker_t*> workers;
+    mutex replyLock;
+    deque<serverReply_t> replies, handling;
+    unsigned seed, started, finished, stopAfter;
+    
+    void send(int fd,const char *s,size_t len) {
+        session_t &session = sessions[fd];
+        if (!session.open)
+            return;
+        bool wasEmpty = session.out.empty();
+        session.out.append(s, len);
+        if (wasEmpty)
+            flush(fd);
+    }
+    void send(int fd,const string &s) { send(fd,s.data(),s.size()); }
+    
+    void flush(int fd) {
+        session_t &session = sessions[fd];
+        size_t sent = 0;
+        while (sent < session.out.size()) {
+            ssize_t n = ::send(fd, session.out.data() + sent, session.out.size() - sent, 0);
+            if (n <= 0)
+                break;
+            sent += n;
+        }
+        session.out.erase(0, sent);
+        if (session.writing != !session.out.empty()) {
+            session.writing = !session.writing;
+            waits.setWriting(fd,session.writing);
+        }
+    }
+    
+    void sendToGame(const serverGame_t &game,const string &s) {
+        for (size_t i=0; i<game.sessions.size(); i++)
+            if (game.sessions[i] >= 0)
+                send(game.sessions[i],s);
+    }
+    
+    void freeGame(size_t id) {
+        serverGame_t &game = games[id];
+        for (size_t i=0; i<game.sessions.size(); i++)
+            if (game.sessions[i] >= 0)
+                sessions[game.sessions[i]].game = NO_GAME;
+        game.inUse = false;
+        freeGames.push_back(id);
+    }
+    
+    void startGame(size_t id) {
+        serverGame_t &game = games[id];
+        game.started = true;
+        game.worker = workers[started % workers.size()];
+        serverRequest_t request;
+        request.kind = serverRequest_t::START;
+        request.game = id;
+        request.seed = seed + started++;
+        request.names = game.names;
+        game.worker->post(request);
+    }
+    
+    void join(int fd,size_t id,const string &name) {
+        session_t &session = sessions[fd];
+        serverGame_t &game = games[id];
+        playerIndex_t seat = 0;
+        while (game.sessions[seat] >= 0)
+            seat++;
+        game.sessions[seat] = fd;
+        game.names[seat] = name.size()? name : "Player " + to_string(seat + 1);
+        session.game = id;
+        session.seat = seat;
+        send(fd,"= " + to_string(id) + " " + to_string(seat) + "\n");
+        if (count(game.sessions.begin(), game.sessions.end(), -1) == 0)
+            startGame(id);
+    }
+    
+    void handleLine(int fd,string &line) {
+        session_t &session = sessions[fd];
+        if (session.game != NO_GAME && games[session.game].started) {
+            serverRequest_t request;
+            request.kind = serverRequest_t::ANSWER;
+            request.game = session.game;
+            request.seat = session.seat;
+            request.line.swap(line);
+            games[session.game].worker->post(request);
+            return;
+        }
+        if (session.game != NO_GAME) {
+            send(fd,"! Still waiting for players.\n");
+            return;
+        }
+        char command[16], name[64];
+        unsigned a = 0, b = 0;
+        name[0] = 0;
+        int fields = sscanf(line.c_str(), "%15s %u %u %63[^\n]", command, &a, &b, name);
+        if (fields >= 1 && !strcmp(command,"quit")) {
+            closeSession(fd);
+            return;
+        }
+        if (fields >= 3 && !strcmp(command,"new")) {
+            if (a < 2 || a > MAX_PLAYERS || b < 1 || b > a) {
+                send(fd,"! A game has 2 to 9 players, at least one of them human.\n");
+                return;
+            }
+            size_t id = games.size();
+            if (freeGames.size()) {
+                id = freeGames.back();
+                freeGames.pop_back();
+            }
+            else
+                games.push_back(serverGame_t());
+            serverGame_t &game = games[id];
+            game.inUse = true;
+            game.started = false;
+            game.humans = playerIndex_t(b);
+            game.names.assign(a, string());
+            game.sessions.assign(b, -1);
+            join(fd,id,name);
+            return;
+        }
+        if (fields >= 2 && !strcmp(command,"join")) {
+            // the name is the third field onwards, though there's no number there.
+            name[0] = 0;
+            sscanf(line.c_str(), "%*s %*u %63[^\n]", name);
+            if (a >= games.size() || !games[a].inUse || games[a].started)
+                send(fd,"! There's no game " + to_string(a) + " waiting for players.\n");
+            else
+                join(fd,a,name);
+            return;
+        }
+        send(fd,"! Expected new <players> <humans> [<name>], join <game> [<name>] or quit.\n");
+    }
+    
+    void readFrom(int fd) {
+        session_t &session = sessions[fd];
+        char buffer[4096];
+        for (;;) {
+            ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+            if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+                closeSession(fd);
+                return;
+            }
+            if (n < 0)
+                break;
+            session.in.append(buffer, n);
+        }
+        size_t start = 0, end;
+        string line;
+        while (session.open && (end = session.in.find('\n', start)) != string::npos) {
+            line.assign(session.in, start, end - start);
+            if (line.size() && line[line.size() - 1] == '\r')
+                line.resize(line.size() - 1);
+            start = end + 1;
+            handleLine(fd,line);
+        }
+        if (!session.open)
+            return;
+        session.in.erase(0, start);
+        if (session.in.size() > MAX_LINE) {
+            send(fd,"! That line is too long.\n");
+            closeSession(fd);
+        }
+    }
+    
+    void closeSession(int fd) {
+        session_t &session = sessions[fd];
+        if (session.game != NO_GAME) {
+            serverGame_t &game = games[session.game];
+            game.sessions[session.seat] = -1;
+            if (game.started) {
+                serverRequest_t request;
+                request.kind = serverRequest_t::LEAVE;
+                request.game = session.game;
+                request.seat = session.seat;
+                game.worker->post(request);
+            }
+            else {
+                game.names[session.seat].clear();
+                if (count(game.sessions.begin(), game.sessions.end(), -1) == int(game.sessions.size()))
+                    freeGame(session.game);
+            }
+        }
+        session.open = false;
+        session.in.clear();
+        session.out.clear();
+        session.game = NO_GAME;
+        waits.remove(fd);
+        close(fd);
+    }
+    
+    void accept() {
+        for (;;) {
+            int fd = ::accept(listener, NULL, NULL);
+            if (fd < 0)
+                return;
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+            int on = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));      // fails harmlessly on Unix sockets
+            if (size_t(fd) >= sessions.size())
+                sessions.resize(fd + 1);
+            session_t &session = sessions[fd];
+            session.open = true;
+            session.writing = false;
+            session.game = NO_GAME;
+            session.in.reserve(MAX_LINE);
+            session.out.reserve(MAX_LINE);
+            waits.add(fd);
+        }
+    }
+    
+    void handleReplies() {
+        char drain[256];
+        while (read(wakeRead, drain, sizeof(drain)) == sizeof(drain))
+            ;
+        {
+            lock_guard<mutex> hold(replyLock);
+            handling.swap(replies);
+        }
+        string lines;
+        for (; handling.size(); handling.pop_front()) {
+            serverReply_t &reply = handling.front();
+            serverGame_t &game = games[reply.game];
+            lines.clear();
+            for (size_t start=0; start<reply.text.size(); ) {
+                size_t end = reply.text.find('\n', start);
+                if (end == string::npos)
+                    end = reply.text.size();
+                lines += ": ";
+                lines.append(reply.text, start, end - start);
+                lines += "\n";
+                start = end + 1;
+            }
+            sendToGame(game,lines);
+            if (reply.waitingOn != NO_PLAYER && game.sessions[reply.waitingOn] >= 0)
+                send(game.sessions[reply.waitingOn],"?\n",2);
+            if (reply.over) {
+                sendToGame(game,". " + to_string(reply.rounds) + " " + to_string(reply.winner) + "\n");
+                freeGame(reply.game);
+                finished++;
+            }
+        }
+    }
+public:
+    gameServer_t(int listening,unsigned threads,unsigned firstSeed,unsigned games) :
+        listener(listening), seed(firstSeed), started(0), finished(0), stopAfter(games) {
+        int ends[2];
+        if (pipe(ends))
+            ends[0] = ends[1] = -1;
+        wakeRead = ends[0];
+        wakeWrite = ends[1];
+        fcntl(wakeRead, F_SETFL, fcntl(wakeRead, F_GETFL) | O_NONBLOCK);
+        fcntl(wakeWrite, F_SETFL, fcntl(wakeWrite, F_GETFL) | O_NONBLOCK);
+        fcntl(listener, F_SETFL, fcntl(listener, F_GETFL) | O_NONBLOCK);
+        waits.add(listener);
+        waits.add(wakeRead);
+        for (unsigned t=0; t<(threads? threads : 1); t++)
+            workers.push_back(new serverWorker_t(*this));
+    }
+    ~gameServer_t() {
+        for (size_t fd=0; fd<sessions.size(); fd++)
+            if (sessions[fd].open) {
+                // whatever's left to say, eg the end of the last game, is worth waiting for.
+                fcntl(int(fd), F_SETFL, fcntl(int(fd), F_GETFL) & ~O_NONBLOCK);
+                flush(int(fd));
+                closeSession(int(fd));
+            }
+        // the workers close whatever games they still have as they stop.
+        for (size_t t=0; t<workers.size(); t++)
+            delete workers[t];
+        close(wakeRead);
+        close(wakeWrite);
+        close(listener);
+    }
+    
+    // Called by the workers.
+    void post(serverReply_t &reply) {
+        bool wasEmpty;
+        {
+            lock_guard<mutex> hold(replyLock);
+            wasEmpty = replies.empty();
+            replies.push_back(serverReply_t());
+            swap(replies.back(),reply);
+        }
+        if (wasEmpty) {
+            // if the pipe's full, the network thread has been woken already
+            ssize_t ignored = write(wakeWrite, "", 1);
+            (void)ignored;
+        }
+    }
+    
+    // Serves until stopAfter games have finished, if that isn't 0; otherwise forever.
+    void serve() {
+        while (!stopAfter || finished < stopAfter)
+            waits.wait([this](int fd,bool readable,bool writable) {
+                if (fd == listener)
+                    accept();
+                else if (fd == wakeRead)
+                    handleReplies();
+                else if (size_t(fd) < sessions.size() && sessions[fd].open) {
+                    if (writable)
+                        flush(fd);
+                    if (readable && sessions[fd].open)
+                        readFrom(fd);
+                }
+            });
+    }
+};
+
+void serverWorker_t::run() {
+    gameHost_t host;
+    vector<size_t> hostIds;         // by the server's id for the game; NO_GAME once it's over
+    deque<serverRequest_t> work;
+    table.setSink(NULL);
+    for (;;) {
+        {
+            unique_lock<mutex> hold(lock);
+            while (!stopping && requests.empty())
+                wake.wait(hold);
+            if (requests.empty())
+                return;
+            work.swap(requests);
+        }
+        for (; work.size(); work.pop_front()) {
+            serverRequest_t &request = work.front();
+            if (request.game >= hostIds.size())
+                hostIds.resize(request.game + 1, NO_GAME);
+            size_t &id = hostIds[request.game];
+            if (request.kind == serverRequest_t::START)
+                id = host.start(request.seed,request.names);
+            else if (id == NO_GAME)
+                continue;           // it's over, and the network thread hadn't heard yet when this was sent
+            else if (request.kind == serverRequest_t::ANSWER)
+                host.answer(id,request.seat,request.line);
+            else
+                host.leave(id,request.seat);
+            
+            serverReply_t reply;
+            reply.game = request.game;
+            reply.text = host.takeOutput(id);
+            reply.waitingOn = host.waitingOn(id);
+            reply.over = host.isOver(id);
+            reply.rounds = host.getRounds(id);
+            reply.winner = reply.over? host.getGame(id).getPlayerAtRank(0) : NO_PLAYER;
+            if (reply.over) {
+                host.close(id);
+                id = NO_GAME;
+            }
+            server.post(reply);
+        }
+    }
+}
+
+static int runServer(const batchOptions_t &options,const char *address,bool stopAfterGames) {
+    signal(SIGPIPE, SIG_IGN);
+    int listener = openSocket(address,true);
+    if (listener < 0)
+        return 1;
+    printf("Serving on %s with %u worker threads.\n", address, options.threads? options.threads : 1);
+    fflush(stdout);
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    {
+        gameServer_t server(listener,options.threads,options.seed,stopAfterGames? options.games : 0);
+        server.serve();
+    }
+    printf("%u games served in %.2f seconds.\n", options.games, chrono::duration<double>(chrono::steady_clock::now() - start).count());
+    return 0;
+}
+
+// Connects count scripted players to a server, each starting a game of its own with computer players in
+// the other seats and answering at random, until --games games have finished between them.
+static int runBots(const batchOptions_t &options,const char *address,size_t count) {
+    signal(SIGPIPE, SIG_IGN);
+    rng_t rng(options.seed);
+    vector<pollfd> bots;
+    vector<string> pending(count);
+    vector<bool> playing(count);
+    string newGame = "new " + to_string(options.playerCount) + " 1 Bot\n";
+    for (size_t b=0; b<count; b++) {
+        int fd = openSocket(address,false);
+        if (fd < 0)
+            return 1;
+        pollfd p = { fd, POLLIN, 0 };
+        bots.push_back(p);
+    }
+    
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    unsigned started = 0, finished = 0, complaints = 0;
+    unsigned long long answers = 0, received = 0;
+    for (size_t b=0; b<count && started<options.games; b++, started++) {
+        if (write(bots[b].fd, newGame.data(), newGame.size()) < 0)
+            return 1;
+        playing[b] = true;
+    }
+    while (finished < started) {
+        if (poll(&bots[0], bots.size(), -1) <= 0)
+            break;
+        for (size_t b=0; b<count; b++) {
+            if (!bots[b].revents)
+                continue;
+            char buffer[65536];
+            ssize_t n = read(bots[b].fd, buffer, sizeof(buffer));
+            if (n <= 0) {
+                if (playing[b]) {
+                    printf("The server hung up.\n");
+                    return 1;
+                }
+                // the server's finished with bots that have finished playing; ignore them from now on.
+                bots[b].fd = -bots[b].fd - 1;
+                continue;
+            }
+            received += n;
+            string &in = pending[b];
+            in.append(buffer, n);
+            size_t begin = 0, end;
+            string out;
+            while ((end = in.find('\n', begin)) != string::npos) {
+                char kind = in[begin];
+                if (kind == '?') {
+                    out += scriptedReplies[rng.below(NELEM(scriptedReplies))];
+                    out += "\n";
+                    answers++;
+                }
+                else if (kind == '.') {
+                    finished++;
+                    playing[b] = started < options.games;
+                    if (playing[b]) {
+                        out += newGame;
+                        started++;
+                    }
+                }
+                else if (kind == '!') {
+                    printf("Bot %zu was told%s\n", b, in.substr(begin + 1, end - begin - 1).c_str());
+                    complaints++;
+                }
+                begin = end + 1;
+            }
+            in.erase(0, begin);
+            if (out.size() && write(bots[b].fd, out.data(), out.size()) < 0)
+                return 1;
+        }
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    for (size_t b=0; b<count; b++)
+        close(bots[b].fd < 0? -bots[b].fd - 1 : bots[b].fd);
+    printf("%zu bots, %u games, %llu answers in %.2f seconds (%.0f a second), %.1f MB received, %u complaints.\n",
+           count, finished, answers, seconds, answers / seconds, received / 1e6, complaints);
+    return complaints? 1 : 0;
+}
+#endif
+
+/*
+    Benchmarks.  Each one times some piece of the engine doing the same work from the same seeds every
+    run, so that results from different builds can be compared.  A benchmark is run for more and more
+    iterations until it takes long enough to time reliably, and reported in nanoseconds per iteration.
+*/
+class benchmark_t {
+protected:
+    string name;
+public:
+    int64_t sink;               // results are added here, and it's read after every run, so the work can't be optimized away
+    benchmark_t(string n) : name(n), sink(0) { }
+    virtual ~benchmark_t() { }
+    const string& getName() const { return name; }
+    // does the work being measured that many times.
+    virtual void run(uint64_t iterations) = 0;
+};
+
+// Exposes the payment search for timing, on hands that don't belong to anybody in a game.
+class paymentBrain_t: public computerBrain_t {
+    player_t holder;
+public:
+    paymentBrain_t(const game_t &theGame) : computerBrain_t("*Benchmark",theGame) { setPlayer(holder); }
+    money_t pay(money_t cost,hand_t &hand,money_t handValue) {
+        holder.totalCredits = handValue;
+        return findBestCards(cost,hand,0,0);
+    }
+};
+
+// Paying for something half the value of a hand of the given size, over a spread of hands.
+class findBestCardsBenchmark_t: public benchmark_t {
+    game_t game;
+    paymentBrain_t brain;
+    vector<hand_t> hands;
+    vector<money_t> values;
+public:
+    findBestCardsBenchmark_t(size_t handSize) : benchmark_t("findBestCards/" + to_string(handSize)), game(2,1), brain(game) {
+        rng_t rng(handSize);
+        bank_t &bank = const_cast<bank_t&>(game.getBank());
+        for (int h=0; h<64; h++) {
+            hand_t hand;
+            hand.clear();
+            money_t total = 0;
+            for (size_t c=0; c<handSize; c++) {
+                // mostly cheap cards, like real hands
+                card_t card = bank[rng.below(rng.below(PRODUCTION_COUNT) + 1)].drawCard(rng);
+                hand.add(card);
+                total += card.value;
+            }
+            hands.push_back(hand);
+            values.push_back(total);
+        }
+    }
+    void run(uint64_t iterations) {
+        for (uint64_t i=0; i<iterations; i++)
+            sink += brain.pay(values[i & 63] / 2,hands[i & 63],values[i & 63]);
+    }
+};
+
+// Drawing a card and discarding it again, so the deck regularly runs out and is reshuffled.
+class drawCardBenchmark_t: public benchmark_t {
+    productionDeck_t deck;
+    rng_t rng;
+public:
+    drawCardBenchmark_t() : benchmark_t("productionDeck_t::drawCard"), rng(1) {
+        deck.init(TITANIUM,deckSpecs[TITANIUM],rng);
+    }
+    void run(uint64_t iterations) {
+        for (uint64_t i=0; i<iterations; i++) {
+            card_t card = deck.drawCard(rng);
+            sink += card.value;
+            deck.discardCard(card.value);
+        }
+    }
+};
+
+class shuffleBenchmark_t: public benchmark_t {
+    productionDeck_t deck;
+    rng_t rng;
+public:
+    shuffleBenchmark_t() : benchmark_t("productionDeck_t::shuffleDeck"), rng(1) {
+        deck.init(TITANIUM,deckSpecs[TITANIUM],rng);
+    }
+    void run(uint64_t iterations) {
+        for (uint64_t i=0; i<iterations; i++)
+            deck.shuffleDeck(rng);
+        sink += deck.drawCard(rng).value;
+    }
+};
+
+// Computer players for a game played partway through, to have something realistic to work on.
+static void setupBenchmarkGame(game_t &game,playerIndex_t playerCount,amt_t rounds) {
+    for (playerIndex_t i=0; i<playerCount; i++)
+        game.setPlayerBrain(i,*new computerBrain_t("*Benchmark",game));
+    game.play(rounds);
+}
+
+// Every player working out who operates what, after the given number of rounds.
+class assignPersonnelBenchmark_t: public benchmark_t {
+    game_t game;
+public:
+    assignPersonnelBenchmark_t(amt_t rounds) : benchmark_t("brain_t::assignPersonnel/" + to_string(rounds)), game(4,1) {
+        setupBenchmarkGame(game,4,rounds);
+    }
+    void run(uint64_t iterations) {
+        const vector<player_t> &players = game.getPlayers();
+        for (uint64_t i=0; i<iterations; i++)
+            for (size_t p=0; p<players.size(); p++)
+                players[p].brain->assignPersonnel();
+        sink += players[0].getVictoryPoints();
+    }
+};
+
+// Every player planning for their turn's auctions, in the middle of a game.
+class planBenchmark_t: public benchmark_t {
+    game_t game;
+public:
+    planBenchmark_t(playerIndex_t playerCount) : benchmark_t("computerBrain_t::plan/" + to_string(playerCount)), game(playerCount,1) {
+        setupBenchmarkGame(game,playerCount,8);
+    }
+    void run(uint64_t iterations) {
+        const vector<player_t> &players = game.getPlayers();
+        for (uint64_t i=0; i<iterations; i++)
+            for (size_t p=0; p<players.size(); p++)
+                players[p].brain->plan(AUCTION_MY_TURN);
+        sink += players[0].getTotalCredits();
+    }
+};
+
+// Refilling the market and running the first player's auctions, from the same mid-game position each time.
+class auctionBenchmark_t: public benchmark_t {
+    game_t game;
+    gameState_t start;
+public:
+    auctionBenchmark_t(playerIndex_t playerCount) : benchmark_t("game_t::auctionUpgradeCards/" + to_string(playerCount)), game(playerCount,1) {
+        setupBenchmarkGame(game,playerCount,8);
+        game.saveState(start);
+    }
+    void run(uint64_t iterations) {
+        for (uint64_t i=0; i<iterations; i++) {
+            game.restoreState(start);
+            game.runOpeningAuctions();
+            sink += game.getPlayers()[0].getTotalCredits();
+        }
+    }
+};
+
+// Random legal answers carried out on a saved game, starting over from the same mid-game position each round.
+class applyActionBenchmark_t: public benchmark_t {
+    gameState_t start, state;
+    decisionPoint_t point;
+    action_t actions[1024];
+    rng_t rng;
+public:
+    applyActionBenchmark_t(playerIndex_t playerCount) : benchmark_t("applyAction/" + to_string(playerCount)), rng(1) {
+        game_t game(playerCount,1);
+        setupBenchmarkGame(game,playerCount,8);
+        game.saveState(start);
+        // play the last round's turns over again
+        start.cursor.turn = 0;
+        start.cursor.stage = TURN_STARTING;
+        state = start;
+        nextDecision(state,point);
+    }
+    void run(uint64_t iterations) {
+        for (uint64_t i=0; i<iterations; i++) {
+            size_t count = legalActions(state,point,actions,NELEM(actions));
+            applyAction(state,point,actions[rng.below(uint32_t(min(count,NELEM(actions))))]);
+            if (point.decision == DECIDE_NOTHING) {
+                state = start;
+                nextDecision(state,point);
+            }
+        }
+        sink += state.players[0].totalCredits;
+    }
+};
+
+// Whole games between computer players.
+class gameBenchmark_t: public benchmark_t {
+    playerIndex_t playerCount;
+public:
+    gameBenchmark_t(playerIndex_t count) : benchmark_t("game_t::play/" + to_string(count)), playerCount(count) { }
+    void run(uint64_t iterations) {
+        for (uint64_t i=0; i<iterations; i++) {
+            game_t game(playerCount,unsigned(i));
+            for (playerIndex_t p=0; p<playerCount; p++)
+                game.setPlayerBrain(p,*new computerBrain_t("*Benchmark",game));
+            sink += game.play(maxBatchRounds);
+        }
+    }
+};
+
+struct benchmarkOptions_t {
+    bool run;
+    const char *filter;         // only run benchmarks with this in their names
+    const char *jsonName;       // also write results here
+    double minSeconds;          // each benchmark runs at least this long
+};
+
+struct benchmarkResult_t {
+    string name;
+    uint64_t iterations;
+    double nanoseconds;         // per iteration
+};
+
+// Where each benchmark's sink ends up, which the compiler has to assume somebody looks at.
+static volatile int64_t benchmarkEscape;
+
+static benchmarkResult_t runBenchmark(benchmark_t &b,double minSeconds) {
+    benchmarkResult_t result = { b.getName(), 1, 0 };
+    for (;;) {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        b.run(result.iterations);
+        benchmarkEscape = b.sink;
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        if (seconds >= minSeconds || result.iterations >= (uint64_t(1) << 40)) {
+            result.nanoseconds = seconds * 1e9 / result.iterations;
+            return result;
+        }
+        // aim a bit past the minimum, growing at least 2x and at most 10x at a time
+        double grow = seconds > 0? 1.4 * minSeconds / seconds : 10;
+        result.iterations = uint64_t(result.iterations * (grow < 2? 2 : grow > 10? 10 : grow));
+    }
+}
+
+static int runBenchmarks(const benchmarkOptions_t &options) {
+    table.setSink(NULL);
+    vector<benchmark_t*> benchmarks;
+    for (size_t handSize=5; handSize<=30; handSize+=5)
+        benchmarks.push_back(new findBestCardsBenchmark_t(handSize));
+    benchmarks.push_back(new drawCardBenchmark_t);
+    benchmarks.push_back(new shuffleBenchmark_t);
+    for (amt_t rounds=5; rounds<=20; rounds+=5)
+        benchmarks.push_back(new assignPersonnelBenchmark_t(rounds));
+    for (playerIndex_t p=2; p<=MAX_PLAYERS; p++)
+        benchmarks.push_back(new planBenchmark_t(p));
+    for (playerIndex_t p=2; p<=MAX_PLAYERS; p++)
+        benchmarks.push_back(new auctionBenchmark_t(p));
+    for (playerIndex_t p=2; p<=MAX_PLAYERS; p++)
+        benchmarks.push_back(new applyActionBenchmark_t(p));
+    for (playerIndex_t p=2; p<=MAX_PLAYERS; p++)
+        benchmarks.push_back(new gameBenchmark_t(p));
+    
+    vector<benchmarkResult_t> results;
+    printf("%-40s %14s %12s\n", "Benchmark", "ns/iteration", "Iterations");
+    for (size_t i=0; i<benchmarks.size(); i++) {
+        if (!options.filter || strstr(benchmarks[i]->getName().c_str(), options.filter)) {
+            results.push_back(runBenchmark(*benchmarks[i],options.minSeconds));
+            const benchmarkResult_t &r = results.back();
+            printf("%-40s %14.1f %12llu\n", r.name.c_str(), r.nanoseconds, (unsigned long long)r.iterations);
+            fflush(stdout);
+        }
+        delete benchmarks[i];
+    }
+    
+    if (options.jsonName) {
+        FILE *f = fopen(options.jsonName,"w");
+        if (!f) {
+            printf("Can't write %s.\n", options.jsonName);
+            return 1;
+        }
+        // laid out like Google Benchmark's JSON so the same tools can read it.
+        time_t now = time(NULL);
+        char date[32];
+        strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", localtime(&now));
+        fprintf(f, "{\n  \"context\": {\n    \"date\": \"%s\",\n    \"executable\": \"outpost\",\n    \"build\": \"%s %s\",\n    \"num_cpus\": %u\n  },\n  \"benchmarks\": [\n",
+                date, __DATE__, __TIME__, thread::hardware_concurrency());
+        for (size_t i=0; i<results.size(); i++)
+            fprintf(f, "    {\n      \"name\": \"%s\",\n      \"iterations\": %llu,\n      \"real_time\": %.3f,\n      \"items_per_second\": %.3f,\n      \"time_unit\": \"ns\"\n    }%s\n",
+                    results[i].name.c_str(), (unsigned long long)results[i].iterations, results[i].nanoseconds, 1e9 / results[i].nanoseconds, i+1<results.size()? ",":"");
+        fprintf(f, "  ]\n}\n");
+        fclose(f);
+    }
+    return 0;
+}
+
+int main(int argc,char **argv) {
+    batchOptions_t batch;
+    replayOptions_t replay = { NULL, 0, 0, false };
+    benchmarkOptions_t benchmark = { false, NULL, NULL, 0.5 };
+    tuneOptions_t tune = { 0, 0, 100, NULL };
+    unsigned environments = 0, hosted = 0, bots = 0;
+    const char *serveAddress = NULL, *checkpointName = NULL;
+    for (int a=1; a<argc; a++) {
+        if (!strncmp(argv[a],"-d",2))
+            debugLevel = atoi(argv[a]+2);
+        else if (!strcmp(argv[a],"--games") && a+1 < argc)
+            batch.games = atoi(argv[++a]);
+        else if (!strcmp(argv[a],"--players") && a+1 < argc)
+            batch.playerCount = atoi(argv[++a]);
+        else if (!strcmp(argv[a],"--seed") && a+1 < argc)
+            batch.seed = atoi(argv[++a]);
+        else if (!strcmp(argv[a],"--threads") && a+1 < argc)
+            batch.threads = atoi(argv[++a]);
+        else if (!strcmp(argv[a],"--search-seats") && a+1 < argc)
+            batch.searchSeats = atoi(argv[++a]);
+        else if (!strcmp(argv[a],"--rollouts") && a+1 < argc)
+            batch.search.rollouts = atoi(argv[++a]);
+        else if (!strcmp(argv[a],"--search-ms") && a+1 < argc)
+            batch.search.milliseconds = atoi(argv[++a]);
+        else if (!strcmp(argv[a],"--search-threads") && a+1 < argc)
+            batch.search.threads = atoi(argv[++a]);
+        else if (!strcmp(argv[a],"--horizon") && a+1 < argc)
+            batch.search.horizon = atoi(argv[++a]);
+        else if (!strcmp(argv[a],"--log") && a+1 < argc)
+            batch.logName = argv[++a];
+        else if (!strcmp(argv[a],"--events") && a+1 < argc)
+            batch.eventsName = argv[++a];
+        else if (!strcmp(argv[a],"--events-json") && a+1 < argc) {
+            batch.eventsName = argv[++a];
+            batch.eventsJson = true;
+        }
+        else if (!strcmp(argv[a],"--record") && a+1 < argc)
+            batch.recordName = argv[++a];
+        else if (!strcmp(argv[a],"--replay") && a+1 < argc)
+            replay.fileName = argv[++a];
+        else if (!strcmp(argv[a],"--replay-game") && a+1 < argc)
+            replay.game = atoi(argv[++a]);
+        else if (!strcmp(argv[a],"--replay-round") && a+1 < argc)
+            replay.round = atoi(argv[++a]);
+        else if (!strcmp(argv[a],"--replay-compare"))
+            replay.compare = true;
+        else if (!strcmp(argv[a],"--personality") && a+1 < argc) {
+            // either a file for every computer seat, or a seat number, a colon, and a file for just that seat
+            const char *fileName = argv[++a];
+            unsigned seat = 0;
+            const char *colon = strchr(fileName,':');
+            if (colon && fileName[0] >= '0' && fileName[0] <= '9') {
+                seat = atoi(fileName);
+                fileName = colon + 1;
+                if (seat < 1 || seat > MAX_PLAYERS) {
+                    printf("--personality seat must be between 1 and %u.\n", unsigned(MAX_PLAYERS));
+                    return 1;
+                }
+            }
+            const aiPersonality_t *ai = loadPersonality(fileName);
+            if (!ai)
+                return 1;
+            for (unsigned i=0; i<MAX_PLAYERS; i++)
+                if (!seat || i == seat - 1)
+                    batch.personalities[i] = ai;
+        }
+        else if (!strcmp(argv[a],"--show-personality")) {
+            // the defaults, as a starting point for a personality file
+            writePersonality(stdout,defaultPersonality);
+            return 0;
+        }
+        else if (!strcmp(argv[a],"--rotate"))
+            batch.rotate = true;
+        else if (!strcmp(argv[a],"--duplicate"))
+            batch.duplicate = batch.rotate = true;
+        else if (!strcmp(argv[a],"--sprt") && a+2 < argc) {
+            // the Elo margins of brain 1 over the rest to decide between, e.g. 0 10; implies --rotate
+            batch.sprt = batch.rotate = true;
+            batch.sprtElo0 = atof(argv[++a]);
+            batch.sprtElo1 = atof(argv[++a]);
+        }
+        else if (!strcmp(argv[a],"--tune") && a+1 < argc)
+            tune.generations = atoi(argv[++a]);
+        else if (!strcmp(argv[a],"--tune-population") && a+1 < argc)
+            tune.population = atoi(argv[++a]);
+        else if (!strcmp(argv[a],"--tune-games") && a+1 < argc)
+            tune.games = atoi(argv[++a]);
+        else if (!strcmp(argv[a],"--tune-out") && a+1 < argc)
+            tune.outName = argv[++a];
+        else if (!strcmp(argv[a],"--env") && a+1 < argc)
+            environments = atoi(argv[++a]);
+        else if (!strcmp(argv[a],"--host") && a+1 < argc)
+            hosted = atoi(argv[++a]);
+        else if (!strcmp(argv[a],"--checkpoint") && a+1 < argc)
+            checkpointName = argv[++a];
+        else if (!strcmp(argv[a],"--serve") && a+1 < argc)
+            serveAddress = argv[++a];
+        else if (!strcmp(argv[a],"--bots") && a+2 < argc) {
+            bots = atoi(argv[++a]);
+            serveAddress = argv[++a];
+        }
+        else if (!strcmp(argv[a],"--benchmark"))
+            benchmark.run = true;
+        else if (!strcmp(argv[a],"--benchmark-filter") && a+1 < argc)
+            benchmark.filter = argv[++a];
+        else if (!strcmp(argv[a],"--benchmark-json") && a+1 < argc)
+            benchmark.jsonName = argv[++a];
+        else if (!strcmp(argv[a],"--benchmark-min-time") && a+1 < argc)
+            benchmark.minSeconds = atof(argv[++a]);
+    }
+    
+    if (replay.fileName)
+        return runReplay(replay);
+    if (benchmark.run || benchmark.filter || benchmark.jsonName)
+        return runBenchmarks(benchmark);
+    
+    if (tune.generations) {
+        if (batch.playerCount < 2 || batch.playerCount > 9) {
+            printf("--players must be between 2 and 9.\n");
+            return 1;
+        }
+        if ((tune.population && tune.population < 4) || !tune.games) {
+            printf("--tune-population must be at least 4 and --tune-games at least 1.\n");
+            return 1;
+        }
+        if (!batch.threads)
+            batch.threads = 1;
+        runTune(batch,tune);
+        return 0;
+    }
+    
+    if (environments || hosted || serveAddress) {
+#if OUTPOST_FIBERS
+        if (batch.playerCount < 2 || batch.playerCount > 9) {
+            printf("--players must be between 2 and 9.\n");
+            return 1;
+        }
+        if (serveAddress && !bots)
+            return runServer(batch,serveAddress,batch.games != 0);
+        if (!batch.games)
+            batch.games = 1000;
+        if (bots)
+            return runBots(batch,serveAddress,bots);
+        if (environments)
+            runEnvironments(batch,environments);
+        else
+            runHost(batch,hosted,checkpointName);
+        return 0;
+#else
+        (void)bots;
+        (void)checkpointName;
+        printf("--env, --host, --serve and --bots aren't available in this build.\n");
+        return 1;
+#endif
+    }
+    
+    if (batch.sprt && !batch.games)
+        batch.games = 1000000;      // the SPRT is expected to stop long before this
+    if (batch.games) {
+        if (batch.sprt && batch.sprtElo0 >= batch.sprtElo1) {
+            printf("--sprt needs the lower Elo margin first.\n");
+            return 1;
+        }
+        if (batch.playerCount < 2 || batch.playerCount > 9) {
+            printf("--players must be between 2 and 9.\n");
+            return 1;
+        }
+        if (batch.searchSeats && !batch.search.rollouts && !batch.search.milliseconds) {
+            printf("--rollouts and --search-ms can't both be zero.\n");
+            return 1;
+        }
+        if (!batch.threads)
+            batch.threads = 1;
+        if (batch.duplicate)
+            batch.games = (batch.games + batch.playerCount - 1) / batch.playerCount * batch.playerCount;
+        runBatch(batch);
+        return 0;
+    }
+    
+    // display rules if no parameters on command line
+    if (argc == 1) {
+        table << basicRules;
+
+        table.setLeftMargin(4);
+        table << "Upgrade Summary:\n";
+        for (int i=0; i<UPGRADE_COUNT; i++) {
+            table << upgradeNames[i] << ": Min bid " << upgradeCosts[i] << ", ";
+            if (vpsForUpgrade[i])
+                table << vpsForUpgrade[i] << "VPs; ";
+            table << upgradeHelp[i] << ".\n";
+        }
+        table << "\nFactory Summary:\n";
+        for (int i=0; i<PRODUCTION_COUNT; i++) {
+            table << factoryNames[i] << ": ";
+            if (factoryCosts[i])
+                table << "Cost " << factoryCosts[i] << ", " ;
+            table << vpsForMannedFactory[i] << " VPs when operated; " << factoryHelp[i] << ".\n";
+        }
+        table << "\n";
+        table.setLeftMargin(0);
+    }
+    
+    table << "Built on " << __DATE__ << " at " << __TIME__ << ".\n";
+    
+    // every game played is added to the record file, if there is one.
+    fileSink_t *record = batch.recordName? openLogFile(batch.recordName,true) : NULL;
+    if (batch.recordName && !record)
+        return 1;
+    
+    do {
+        unsigned playerCount;
+        
+        // seed the RNG, but let it be overridden from user input
+        unsigned seed = (unsigned) time(NULL);
+        
+        for (;;) {
+            table << "Number of players?  (2-9) ";
+            playerCount = readUnsigned();
+            // input has run out, so there's nobody to ask again
+            if (playerCount == EMPTY && !cin) {
+                table << "\n";
+                table.flush();
+                delete record;
+                return 0;
+            }
+            if (playerCount >= 10 && playerCount < 20)
+                debugLevel = playerCount - 10;
+            else if (playerCount < 2 || playerCount > 9)
+                seed = playerCount;
+            else
+                break;
+        }
+
+        table << "(using " << seed << " as RNG seed)" << "\n";
+
+        game_t game(playerCount,seed);
+        decisionLog_t decisions;
+        decisions.seed = seed;
+        
+        vector<string> computerNames;
+        computerNames.push_back("*Alan T.");
+        computerNames.push_back("*Steve J.");
+        computerNames.push_back("*Grace H.");
+        computerNames.push_back("*Donald K.");
+        computerNames.push_back("*Dennis R.");
+        computerNames.push_back("*Bjarne S.");
+        computerNames.push_back("*Herb S.");
+        computerNames.push_back("*Bill G.");
+        computerNames.push_back("*James H.");
+        rng_t nameRng(seed);
+        nameRng.shuffle(computerNames.begin(), computerNames.end());
+      
+        // attach brains to each player
+        table << "If you enter an empty string for a name, that and all future players will be run by computer.  ";
+        table << "Players should be entered in seating order (aka auction bidding order).\n";
+        table.setLeftMargin(4);
+        
+        bool anyHumans = true;
+        for (int i=0; i<playerCount; i++) {
+            string name;
+            if (anyHumans) {
+                table << "Player " << i+1 << " name? ";
+                table.flush();
+                if (!keyboard.readLine(name))
+                    name.clear();
+                if (name.size() == 0)
+                    anyHumans = false;
+            }
+            brain_t *thisBrain;
+            bool computer = name.size() == 0;
+            if (computer) {
+                name = computerNames.back();
+                computerNames.pop_back();
+                thisBrain = new computerBrain_t(name,game,batch.personalities[i]? *batch.personalities[i] : defaultAi);
+            }
+            else {
+                thisBrain = new playerBrain_t(name);
+                anyHumansInGame = true;
+            }
+            if (record) {
+                thisBrain = new recordingBrain_t(*thisBrain,decisions);
+                decisions.names.push_back(name);
+                if (computer)
+                    decisions.computers |= 1U << i;
+            }
+                
+              game.setPlayerBrain(i,*thisBrain);
+        }
+
+        decisions.rounds = game.play();
+        if (record) {
+            decisions.save(*record);
+            record->flush();
+        }
         table << "Play again? (y/n) ";
     } while (readLetter() == 'Y');
+    delete record;
 }